@@ -0,0 +1,221 @@
+import os
+import sys
+import argparse
+import subprocess
+from datetime import datetime
+import numpy as np
+import pandas as pd
+from Model import db, Experiment, Baseline
+from Topology import Topology
+
+
+'''
+Standard scaling benchmark: RippleTrickle, Orchestra and the 6TiSCH minimal schedule (RT_SCHEDULER, see the Makefile) on the same
+matrix of grid sizes, send intervals, slotframe lengths and random seeds. Every seed is simulated under each scheduler, so runs
+have like-for-like twins. The runs of a suite are stored as a tagged Baseline, and compare() flags the metrics of a tag that changed
+significantly against another tag, with a permutation test (paired by seed when both tags simulated the same seeds) whose p-values
+are Holm corrected over every cell and metric compared.
+
+    python3 Benchmark.py run v1.0
+    python3 Benchmark.py report v1.0
+    python3 Benchmark.py compare v1.0 my-change
+'''
+BenchmarkDir = "benchmarks"
+Schedulers = ['rippletrickle', 'orchestra', 'minimal']
+Matrix = {
+    'size': [4, 8, 12], # grid side, 16 to 144 nodes
+    'APP_SEND_INTERVAL_SEC': [1, 5],
+    'TSCH_SCHEDULE_CONF_DEFAULT_LENGTH': [7, 19],
+    'randomseed': [1, 2, 3, 4, 5, 6, 7, 8], # a paired test needs 6 seeds or more to reach p < 0.05
+}
+# Summary metric: higher is better
+ReportMetrics = {
+    'app-pdr': True,
+    'app-latency': False,
+    'app-latency-p99': False,
+    'app-latency-p99.9': False,
+    'energy-RDC': False,
+    'mac-6p': False,
+    'mac-formation': False,
+}
+# Runs of the same cell are those with the same values of
+CellKeys = ['nodes', 'APP_SEND_INTERVAL_SEC', 'TSCH_SCHEDULE_CONF_DEFAULT_LENGTH', 'RT_SCHEDULER', 'TIMEOUT']
+
+def revision():
+    try:
+        return subprocess.check_output(['git', 'rev-parse', '--short', 'HEAD'], stderr=subprocess.DEVNULL, universal_newlines=True).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+def experiment(size):
+    '''
+    The experiment of a grid size, its scenario is generated the first time. Runs set their own TIMEOUT (see run)
+    '''
+    name = "benchmark grid-{}x{}".format(size, size)
+    found = db.query(Experiment).filter_by(name=name).first()
+    if found is not None:
+        return found
+    os.makedirs(BenchmarkDir, exist_ok=True)
+    simFile = os.path.join(BenchmarkDir, "grid-{}x{}.csc".format(size, size))
+    Topology.grid(size, size).toCsc(simFile)
+    found = Experiment(name=name, experimentFile=simFile)
+    db.add(found)
+    db.commit()
+    return found
+
+def run(tag, matrix=None, schedulers=None, concurrency=None, timeout=1200):
+    '''
+    Simulates the whole matrix under each scheduler, timeout simulated seconds each, and stores the runs as the Baseline tag
+    '''
+    matrix = dict(matrix or Matrix)
+    if db.query(Baseline).filter_by(tag=tag).first() is not None:
+        raise ValueError("There is already a baseline tagged " + tag)
+    sizes = matrix.pop('size')
+    variations = dict(matrix, RT_SCHEDULER=list(schedulers or Schedulers), TIMEOUT=[int(timeout * 1000)])
+    runs = []
+    status = "Done"
+    for size in sizes:
+        exp = experiment(size)
+        before = {r.id for r in exp.runs}
+        if exp.bulkRun(variations, 1, concurrency) != "Done":
+            status = "Error"
+        runs.extend(r for r in exp.runs if r.id not in before)
+    baseline = Baseline(tag=tag, created=datetime.now(), revision=revision(), matrix=dict(variations, size=sizes), runs=runs)
+    db.add(baseline)
+    db.commit()
+    print("Baseline {}: {} runs ({})".format(tag, len(runs), status))
+    return baseline
+
+def getBaseline(tag):
+    baseline = db.query(Baseline).filter_by(tag=tag).first()
+    if baseline is None:
+        raise KeyError("No baseline tagged " + tag)
+    return baseline
+
+def frame(tag):
+    result = getBaseline(tag).getFrame()
+    for key in CellKeys:
+        if key not in result.columns:
+            result[key] = "" # Runs from before the parameter was recorded
+    metrics = [metric for metric in ReportMetrics if metric in result.columns]
+    result[metrics] = result[metrics].apply(pd.to_numeric, errors='coerce')
+    return result
+
+def report(tag):
+    '''
+    Mean and 95% confidence interval half width of each metric, per cell, the schedulers side by side
+    '''
+    result = frame(tag)
+    grouped = result.groupby(CellKeys)[list(ReportMetrics)]
+    stats = pd.concat({'mean': grouped.mean(), 'ci95': 1.96 * grouped.std() / grouped.count().pow(0.5)}, axis=1)
+    stats.columns = ['{}-{}'.format(metric, stat) for stat, metric in stats.columns]
+    return stats[['{}-{}'.format(metric, stat) for metric in ReportMetrics for stat in ('mean', 'ci95')]].reset_index()
+
+def permutationTest(a, b, paired=False, permutations=10000, seed=0):
+    '''
+    Two sided p-value of the difference of means of b and a. Paired samples (a[i] and b[i] from the same seed) have the signs of
+    their differences permuted, otherwise the labels of the pooled samples are
+    '''
+    rng = np.random.default_rng(seed)
+    if paired:
+        diffs = np.asarray(b, dtype=float) - np.asarray(a, dtype=float)
+        observed = abs(diffs.mean())
+        signs = rng.choice((-1.0, 1.0), size=(permutations, len(diffs)))
+        permuted = np.abs((signs * diffs).mean(axis=1))
+    else:
+        a, b = np.asarray(a, dtype=float), np.asarray(b, dtype=float)
+        observed = abs(b.mean() - a.mean())
+        pooled = rng.permuted(np.tile(np.concatenate([a, b]), (permutations, 1)), axis=1)
+        permuted = np.abs(pooled[:, len(a):].mean(axis=1) - pooled[:, :len(a)].mean(axis=1))
+    return (1 + np.count_nonzero(permuted >= observed - 1e-12)) / (permutations + 1)
+
+def holm(pvalues):
+    '''
+    Holm-Bonferroni adjusted p-values, in the same order
+    '''
+    pvalues = np.asarray(pvalues, dtype=float)
+    order = np.argsort(pvalues)
+    adjusted = np.empty(len(pvalues))
+    adjusted[order] = np.minimum(1, np.maximum.accumulate(pvalues[order] * (len(pvalues) - np.arange(len(pvalues)))))
+    return adjusted
+
+def compare(baselineTag, candidateTag, alpha=0.05, permutations=10000):
+    '''
+    One row per cell and metric with both means, the relative change, the p-value, the p-value adjusted over all the rows (Holm,
+    so the chance of any false verdict stays under alpha) and a verdict: "regression" or "improvement" when the adjusted p < alpha
+    '''
+    base, candidate = frame(baselineTag), frame(candidateTag)
+    rows = []
+    for cell, current in candidate.groupby(CellKeys):
+        previous = base
+        for key, value in zip(CellKeys, cell):
+            previous = previous[previous[key] == value]
+        if previous.empty:
+            continue
+        for metric, higherIsBetter in ReportMetrics.items():
+            a, b = previous[metric].dropna().values, current[metric].dropna().values
+            if len(a) < 2 or len(b) < 2:
+                continue
+            pairs = previous[['randomseed', metric]].merge(current[['randomseed', metric]], on='randomseed').dropna()
+            paired = len(pairs) == len(a) == len(b)
+            if paired:
+                p = permutationTest(pairs[metric + '_x'].values, pairs[metric + '_y'].values, True, permutations)
+            else:
+                p = permutationTest(a, b, False, permutations)
+            change = b.mean() - a.mean()
+            row = dict(zip(CellKeys, cell))
+            row.update({'metric': metric, 'baseline': a.mean(), 'candidate': b.mean(),
+                'change%': 100 * change / abs(a.mean()) if a.mean() else None, 'p': p, 'paired': paired,
+                'better': None if change == 0 else (change > 0) == higherIsBetter})
+            rows.append(row)
+    result = pd.DataFrame(rows)
+    if result.empty:
+        return result
+    result['p-holm'] = holm(result['p'])
+    result['verdict'] = [("improvement" if better else "regression") if adjusted < alpha and better is not None else ""
+        for adjusted, better in zip(result['p-holm'], result['better'])]
+    return result.drop(columns='better')
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description="RippleTrickle, Orchestra and minimal schedule benchmark")
+    commands = parser.add_subparsers(dest='command', required=True)
+    runParser = commands.add_parser('run', help="simulate the matrix and store it as a baseline")
+    runParser.add_argument('tag')
+    runParser.add_argument('--sizes', type=int, nargs='+', default=Matrix['size'])
+    runParser.add_argument('--intervals', type=int, nargs='+', default=Matrix['APP_SEND_INTERVAL_SEC'])
+    runParser.add_argument('--slotframes', type=int, nargs='+', default=Matrix['TSCH_SCHEDULE_CONF_DEFAULT_LENGTH'])
+    runParser.add_argument('--seeds', type=int, nargs='+', default=Matrix['randomseed'])
+    runParser.add_argument('--schedulers', nargs='+', default=Schedulers, choices=Schedulers)
+    runParser.add_argument('--concurrency', type=int)
+    runParser.add_argument('--timeout', type=int, default=1200, help="simulated seconds")
+    reportParser = commands.add_parser('report', help="metrics of a baseline per cell")
+    reportParser.add_argument('tag')
+    compareParser = commands.add_parser('compare', help="significant changes of candidate against baseline")
+    compareParser.add_argument('baseline')
+    compareParser.add_argument('candidate')
+    compareParser.add_argument('--alpha', type=float, default=0.05)
+    compareParser.add_argument('--output', help="also write the report to this CSV")
+    args = parser.parse_args(argv)
+
+    pd.set_option('display.width', 200)
+    pd.set_option('display.max_rows', None)
+    if args.command == 'run':
+        matrix = {'size': args.sizes, 'APP_SEND_INTERVAL_SEC': args.intervals, 'TSCH_SCHEDULE_CONF_DEFAULT_LENGTH': args.slotframes, 'randomseed': args.seeds}
+        run(args.tag, matrix, args.schedulers, args.concurrency, args.timeout)
+        return 0
+    if args.command == 'report':
+        print(report(args.tag).to_string(index=False, float_format='{:.3f}'.format))
+        return 0
+    result = compare(args.baseline, args.candidate, args.alpha)
+    if args.output:
+        result.to_csv(args.output, index=False)
+    if result.empty:
+        print("Nothing to compare, the tags have no cell in common")
+        return 0
+    print(result.to_string(index=False, float_format='{:.4g}'.format))
+    regressions = result[result['verdict'] == 'regression']
+    print("{} regressions, {} improvements".format(len(regressions), (result['verdict'] == 'improvement').sum()))
+    return 1 if len(regressions) else 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,128 @@
+import os
+import json
+import shutil
+import hashlib
+import subprocess
+from xml.dom import minidom
+
+
+'''
+Content addressed cache of the Cooja firmware build and of the viewconf parameters, used by Experiment.bulkRun.
+The key is a hash of the firmware sources, Makefile, project-conf.h and the build commands of the .csc, so runs that only differ by
+randomseed (repetitions, or the same permutation in a later sweep) reuse the compiled mote instead of building it again.
+It also covers the Contiki tree the Makefile includes: its git HEAD and a hash of its uncommitted changes, so a build made before a
+checkout or an edit of the stack isn't restored after it.
+'''
+Firmware = (".cooja", ".native")
+
+class BuildCache:
+    sources = ["Makefile", "node-rt.c", "sf-simple-rt.h", "sf-simple-rt.c", "project-conf.h"]
+
+    def __init__(self, cacheDir="buildcache"):
+        self.cacheDir = cacheDir
+
+    def key(self, workDir, simFile=None, target="cooja"):
+        '''
+        target keeps the native build (NativeRunner) apart from the Cooja one of the same sources
+        '''
+        digest = hashlib.sha256()
+        if target != "cooja":
+            digest.update(target.encode())
+        digest.update(self.contikiRevision(workDir).encode())
+        for name in self.sources + (["native-radio-rt.c"] if target == "native" else []):
+            digest.update(name.encode())
+            with open(os.path.join(workDir, name), 'rb') as f:
+                digest.update(f.read())
+        if simFile is not None:
+            for commands in minidom.parse(simFile).getElementsByTagName('commands'):
+                digest.update(commands.firstChild.data.encode())
+        return digest.hexdigest()
+
+    def contikiDir(self, workDir):
+        '''
+        CONTIKI of the Makefile in workDir, absolute once Experiment.prepareWorkDir rewrote it
+        '''
+        with open(os.path.join(workDir, "Makefile")) as f:
+            for line in f:
+                if line.startswith("CONTIKI="):
+                    return os.path.join(workDir, line.split("=", 1)[1].strip())
+        return os.path.join(workDir, "../..")
+
+    def contikiRevision(self, workDir):
+        '''
+        HEAD of the Contiki tree and the sha256 of its git diff, "" when it isn't a git checkout
+        '''
+        try:
+            contiki = self.contikiDir(workDir)
+            head = subprocess.run(["git", "rev-parse", "HEAD"], cwd=contiki, capture_output=True, check=True).stdout.decode().strip()
+            diff = subprocess.run(["git", "diff", "HEAD"], cwd=contiki, capture_output=True, check=True).stdout
+        except (OSError, subprocess.CalledProcessError):
+            return ""
+        return head + ":" + hashlib.sha256(diff).hexdigest()
+
+    def path(self, key):
+        return os.path.join(self.cacheDir, key)
+
+    def hasBuild(self, key):
+        return os.path.isdir(os.path.join(self.path(key), "build"))
+
+    def store(self, key, workDir):
+        '''
+        Keeps the build folder and the firmware Cooja (or make TARGET=native) built in workDir
+        '''
+        if self.hasBuild(key) or not os.path.isdir(os.path.join(workDir, "build")):
+            return False
+        os.makedirs(self.path(key), exist_ok=True)
+        partial = os.path.join(self.path(key), "build.partial")
+        shutil.rmtree(partial, ignore_errors=True)
+        shutil.copytree(os.path.join(workDir, "build"), partial, symlinks=True)
+        for name in os.listdir(workDir):
+            if name.endswith(Firmware):
+                shutil.copy(os.path.join(workDir, name), self.path(key))
+        os.rename(partial, os.path.join(self.path(key), "build"))
+        return True
+
+    def restore(self, key, workDir):
+        '''
+        Copies a cached build to workDir with fresh timestamps, so make finds the firmware up to date
+        '''
+        if not self.hasBuild(key):
+            return False
+        shutil.copytree(os.path.join(self.path(key), "build"), os.path.join(workDir, "build"), symlinks=True, dirs_exist_ok=True)
+        for name in os.listdir(self.path(key)):
+            if name.endswith(Firmware):
+                shutil.copy(os.path.join(self.path(key), name), workDir)
+        for root, dirs, files in os.walk(os.path.join(workDir, "build")):
+            for name in files:
+                os.utime(os.path.join(root, name), follow_symlinks=False)
+        for name in os.listdir(workDir):
+            if name.endswith(Firmware):
+                os.utime(os.path.join(workDir, name))
+        return True
+
+    def build(self, key, workDir, simFile):
+        '''
+        Makes sure workDir has the firmware of key: restores it, or runs the build commands of the .csc there as Cooja would and
+        stores the result. The runs of a key can then all start at once. False when make failed, build.log in workDir has its output
+        '''
+        if self.restore(key, workDir):
+            return True
+        with open(os.path.join(workDir, "build.log"), "w") as log:
+            for commands in minidom.parse(simFile).getElementsByTagName('commands'):
+                command = commands.firstChild.data.replace("$(CPUS)", str(os.cpu_count() or 1))
+                if subprocess.run(command, shell=True, cwd=workDir, stdout=log, stderr=subprocess.STDOUT).returncode != 0:
+                    return False
+        self.store(key, workDir)
+        return True
+
+    def loadParameters(self, key):
+        try:
+            with open(os.path.join(self.path(key), "viewconf.json")) as f:
+                return json.load(f)
+        except (OSError, ValueError):
+            return None
+
+    def storeParameters(self, key, parameters):
+        os.makedirs(self.path(key), exist_ok=True)
+        with open(os.path.join(self.path(key), "viewconf.json"), 'w') as f:
+            json.dump(parameters, f)
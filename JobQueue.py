@@ -0,0 +1,232 @@
+import os
+import shutil
+import threading
+from datetime import datetime
+from concurrent.futures import ThreadPoolExecutor, wait, FIRST_COMPLETED
+from Model import db, Job, JobSlots, JobDir, Run
+from Runner import Runner
+from BuildCache import BuildCache
+from LiveMetrics import LiveIngest, ConvergenceMonitor
+
+
+'''
+Runs the jobs table: up to slots simulations at the same time, each one in JobDir/<job id>, highest priority first.
+The dispatcher thread is the only one that ingests runs, the workers only run Cooja. While a job runs, the dispatcher tails its test
+log every pollInterval (LiveIngest), so the records are already stored when Cooja exits and live metrics can be queried.
+Jobs with a convergence setting are watched by a ConvergenceMonitor, which stops Cooja once their metrics settle.
+Jobs left running by a previous process are queued again when the queue starts, so an interrupted sweep carries on where it stopped.
+'''
+class JobQueue:
+    def __init__(self, slots=None, pollInterval=1.0, onDone=None):
+        self.slots = slots or JobSlots
+        self.pollInterval = pollInterval
+        # Called with the new Run after each job is ingested (api.py prerenders its plots)
+        self.onDone = onDone
+        self.cache = BuildCache()
+        self.builds = {} # build key: lock held by the worker building it, the jobs of the same key wait and restore that build
+        self.running = {} # future: (job id, work dir, build key)
+        self.runners = {}
+        self.live = {} # job id: LiveIngest
+        self.monitors = {} # job id: ConvergenceMonitor
+        self.cancelled = set()
+        self.wake = threading.Event()
+        self.lock = threading.Lock()
+        self.thread = None
+
+    def start(self):
+        with self.lock:
+            if self.thread is None:
+                self.thread = threading.Thread(target=self.loop, daemon=True)
+                self.thread.start()
+
+    def submit(self, experiment, defines=None, priority=0, convergence=None):
+        job = experiment.enqueue(defines, priority, convergence)
+        self.wake.set()
+        return job
+
+    def submitBulk(self, experiment, dictVariations, repetitions, priority=0, convergence=None):
+        jobs = experiment.enqueueBulk(dictVariations, repetitions, priority, convergence)
+        self.wake.set()
+        return jobs
+
+    def cancel(self, jobId):
+        '''
+        Queued jobs are cancelled right away, running ones have their Cooja process killed and are marked when the worker returns
+        '''
+        job = db.get(Job, jobId)
+        if job is None:
+            return None
+        if job.state == 'queued':
+            job.state = 'cancelled'
+            job.finished = datetime.now()
+            db.commit()
+        elif job.state == 'running':
+            self.cancelled.add(jobId)
+            runner = self.runners.get(jobId)
+            if runner is not None:
+                runner.cancel()
+        return job
+
+    def requeue(self, jobId, priority=None):
+        job = db.get(Job, jobId)
+        if job is None or job.state not in ('failed', 'cancelled'):
+            return job
+        job.state = 'queued'
+        job.started = job.finished = job.message = None
+        if priority is not None:
+            job.priority = priority
+        db.commit()
+        self.wake.set()
+        return job
+
+    def resume(self):
+        '''
+        Queues the jobs left running again, without the runs (and records) their live ingest had started
+        '''
+        jobs = db.query(Job).filter_by(state='running').all()
+        for job in jobs:
+            if job.liveRun is not None:
+                job.liveRun.discard()
+            job.state = 'queued'
+            job.started = None
+            job.liveRun_id = None
+            db.commit()
+        if jobs:
+            print("Queued again {} interrupted jobs".format(len(jobs)))
+
+    def loop(self):
+        self.resume()
+        with ThreadPoolExecutor(max_workers=self.slots) as pool:
+            while True:
+                self.dispatch(pool)
+                if not self.running:
+                    self.wake.wait(self.pollInterval)
+                    self.wake.clear()
+                    continue
+                finished, pending = wait(list(self.running), timeout=self.pollInterval, return_when=FIRST_COMPLETED)
+                for future in finished:
+                    self.finish(future)
+                self.pollLive()
+
+    def pollLive(self):
+        '''
+        Ingests what the running jobs logged since the last poll. A job whose live ingest fails carries on without it, its log is
+        then read in full when it ends
+        '''
+        for jobId, live in list(self.live.items()):
+            try:
+                live.poll()
+            except Exception as ex:
+                print("Live ingest of job {} stopped: {}".format(jobId, ex))
+                db.rollback()
+                self.live.pop(jobId).abort()
+                db.get(Job, jobId).liveRun_id = None
+                db.commit()
+                continue
+            monitor = self.monitors.get(jobId)
+            if monitor is not None and monitor.reason is None and monitor.update(live.status()):
+                print("Job {} {} at {} s, stopping".format(jobId, monitor.reason, monitor.stopTime // 1000000))
+                open(os.path.join(JobDir, str(jobId), "STOP"), "w").close()
+
+    def liveStatus(self, jobId):
+        live = self.live.get(jobId)
+        return live.status() if live is not None else None
+
+    def dispatch(self, pool):
+        while len(self.running) < self.slots:
+            job = db.query(Job).filter_by(state='queued').order_by(Job.priority.desc(), Job.id).first()
+            if job is None:
+                return
+            job.state = 'running'
+            job.started = datetime.now()
+            db.commit()
+            workDir = job.workDir()
+            try:
+                shutil.rmtree(workDir, ignore_errors=True)
+                os.makedirs(JobDir, exist_ok=True)
+                stopFile = os.path.join(workDir, "STOP") if job.convergence is not None else None
+                job.experiment.prepareWorkDir(workDir, job.defines, stopFile)
+                simFile = os.path.join(workDir, os.path.basename(job.experiment.experimentFile))
+                key = self.cache.key(workDir, simFile)
+                # The run only joins the experiment when it's ingested, so pages don't list it half done
+                run = Run(start=job.started)
+                db.add(run)
+                db.flush()
+                job.liveRun_id = run.id
+                db.commit()
+                self.live[job.id] = LiveIngest(run, os.path.join(workDir, "COOJA.testlog"))
+                if job.convergence is not None:
+                    self.monitors[job.id] = ConvergenceMonitor(**dict({'warmUp': job.experiment.getWarmUp(job.defines)}, **job.convergence))
+            except Exception as ex:
+                job.state = 'failed'
+                job.message = "{}: {}".format(type(ex).__name__, ex)[:500]
+                job.finished = datetime.now()
+                db.commit()
+                continue
+            print("Job {} started ({})".format(job.id, workDir))
+            self.running[pool.submit(self.execute, job.id, simFile, workDir, key)] = (job.id, workDir, key)
+
+    def execute(self, jobId, simFile, workDir, key):
+        '''
+        Runs on a worker thread, so it doesn't touch the session. The firmware is built once per key (BuildCache.build), if that
+        fails Cooja builds it and reports the error in the job log
+        '''
+        with self.builds.setdefault(key, threading.Lock()):
+            self.cache.build(key, workDir, simFile)
+        runner = Runner(simFile, workDir=workDir)
+        self.runners[jobId] = runner
+        if jobId in self.cancelled:
+            runner.cancel()
+        start = datetime.now()
+        try:
+            ok = runner.run() == 0
+        finally:
+            self.runners.pop(jobId, None)
+            runner.log.close()
+        return start, datetime.now(), ok
+
+    def finish(self, future):
+        jobId, workDir, key = self.running.pop(future)
+        job = db.get(Job, jobId)
+        live = self.live.pop(jobId, None)
+        monitor = self.monitors.pop(jobId, None)
+        try:
+            start, end, ok = future.result()
+            if jobId in self.cancelled:
+                job.state = 'cancelled'
+            elif not ok:
+                job.state = 'failed'
+                job.message = "Simulation failed, see the job log"
+            else:
+                self.cache.store(key, workDir)
+                job.run = job.experiment.ingest(workDir, start, end, self.cache, key, live)
+                if monitor is not None and monitor.reason is not None:
+                    job.run.stopReason = monitor.reason
+                    job.run.stopTime = monitor.stopTime
+                else:
+                    job.run.stopReason = "timeout"
+                    # Without live ingest (it was aborted) the stop time is left unknown
+                    job.run.stopTime = live.metrics.simTime if live is not None else None
+                job.state = 'done'
+                live = None
+        except Exception as ex:
+            db.rollback()
+            job.state = 'failed'
+            job.message = "{}: {}".format(type(ex).__name__, ex)[:500]
+        self.cancelled.discard(jobId)
+        job.finished = datetime.now()
+        job.liveRun_id = None
+        db.commit()
+        if live is not None and job.state != 'done':
+            live.abort()
+        if os.path.exists(os.path.join(workDir, "COOJA.log")):
+            shutil.move(os.path.join(workDir, "COOJA.log"), os.path.join(JobDir, "{}.log".format(jobId)))
+        if job.state == 'done':
+            shutil.rmtree(workDir)
+        db.commit()
+        print("Job {} {}".format(jobId, job.state))
+        if job.state == 'done' and self.onDone is not None:
+            try:
+                self.onDone(job.run)
+            except Exception as ex:
+                print(ex)
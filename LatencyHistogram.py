@@ -0,0 +1,119 @@
+import math
+import numpy as np
+
+
+'''
+Fixed-bucket latency histograms in the HDR style: values (integer microseconds) below 2^bits get a bucket of their own, larger ones
+share log-linear buckets 2^k wide holding 2^(bits-1) buckets per power of two, so every bucket is within 2^(1-bits) of its values
+(0.8% with the default 8 bits) whatever the range. Histograms with the same bits merge by adding their counts, which is how the
+repetitions of a scenario are pooled without keeping the raw samples. Quantiles are the highest value of the bucket holding the rank,
+like HdrHistogram's getValueAtPercentile, clamped to the exact minimum and maximum.
+'''
+SignificantBits = 8
+
+class LatencyHistogram:
+    def __init__(self, bits=SignificantBits, counts=None, total=0, valueSum=0, minimum=None, maximum=None):
+        self.bits = bits
+        self.counts = dict(counts or {}) # bucket index: samples
+        self.total = total
+        self.sum = valueSum
+        self.minimum = minimum
+        self.maximum = maximum
+
+    @staticmethod
+    def buckets(values, bits=SignificantBits):
+        '''
+        Bucket index of each value: v for v < 2^bits, otherwise k * 2^(bits-1) + (v >> k) where k is the shift that leaves bits bits
+        '''
+        values = np.maximum(np.asarray(values, dtype=np.int64), 0)
+        exponent = np.frexp(values.astype(np.float64))[1] # bit length, exact below 2^53
+        shift = np.maximum(exponent - bits, 0).astype(np.int64)
+        return shift * (1 << (bits - 1)) + (values >> shift)
+
+    def lowest(self, index):
+        half = 1 << (self.bits - 1)
+        shift = max(index // half - 1, 0)
+        return (index - shift * half) << shift
+
+    def highest(self, index):
+        half = 1 << (self.bits - 1)
+        return self.lowest(index) + (1 << max(index // half - 1, 0)) - 1
+
+    @staticmethod
+    def of(values, bits=SignificantBits):
+        return LatencyHistogram.byKey(np.zeros(len(values), dtype=np.int64), values, bits).get(0, LatencyHistogram(bits))
+
+    @staticmethod
+    def byKey(keys, values, bits=SignificantBits):
+        '''
+        One histogram per distinct key, keys[i] being the key of values[i] (ex: the source node of each latency)
+        '''
+        keys, values = np.asarray(keys), np.asarray(values, dtype=np.int64)
+        if not len(values):
+            return {}
+        unique, inverse = np.unique(keys, return_inverse=True)
+        inverse = inverse.reshape(-1)
+        pairs, counts = np.unique(np.stack([inverse, LatencyHistogram.buckets(values, bits)]), axis=1, return_counts=True)
+        minimum = np.full(len(unique), np.iinfo(np.int64).max)
+        maximum = np.full(len(unique), np.iinfo(np.int64).min)
+        np.minimum.at(minimum, inverse, values)
+        np.maximum.at(maximum, inverse, values)
+        sums = np.bincount(inverse, weights=values, minlength=len(unique))
+        totals = np.bincount(inverse, minlength=len(unique))
+        result = {}
+        for i, key in enumerate(unique.tolist()):
+            result[key] = LatencyHistogram(bits, None, int(totals[i]), int(sums[i]), int(minimum[i]), int(maximum[i]))
+        for (i, index), count in zip(pairs.T.tolist(), counts.tolist()):
+            result[unique[i].item()].counts[index] = count
+        return result
+
+    def record(self, value, count=1):
+        value = max(int(value), 0)
+        index = int(self.buckets([value], self.bits)[0])
+        self.counts[index] = self.counts.get(index, 0) + count
+        self.total += count
+        self.sum += value * count
+        self.minimum = value if self.minimum is None else min(self.minimum, value)
+        self.maximum = value if self.maximum is None else max(self.maximum, value)
+
+    def merge(self, other):
+        '''
+        Adds the samples of other to this histogram
+        '''
+        if other.bits != self.bits:
+            raise ValueError("Can't merge histograms of {} and {} bits".format(self.bits, other.bits))
+        for index, count in other.counts.items():
+            self.counts[index] = self.counts.get(index, 0) + count
+        self.total += other.total
+        self.sum += other.sum
+        if other.minimum is not None:
+            self.minimum = other.minimum if self.minimum is None else min(self.minimum, other.minimum)
+            self.maximum = other.maximum if self.maximum is None else max(self.maximum, other.maximum)
+        return self
+
+    @staticmethod
+    def mergeAll(histograms, bits=SignificantBits):
+        result = LatencyHistogram(bits)
+        for histogram in histograms:
+            result.merge(histogram)
+        return result
+
+    def mean(self):
+        return self.sum / self.total if self.total else None
+
+    def quantile(self, q):
+        '''
+        Value at the q percentile (0 to 100), None when empty
+        '''
+        if not self.total:
+            return None
+        rank = max(1, math.ceil(q / 100 * self.total))
+        seen = 0
+        for index in sorted(self.counts):
+            seen += self.counts[index]
+            if seen >= rank:
+                return max(self.minimum, min(self.highest(index), self.maximum))
+        return self.maximum
+
+    def quantiles(self, qs):
+        return {q: self.quantile(q) for q in qs}
@@ -0,0 +1,186 @@
+import os
+import threading
+from collections import deque
+import numpy as np
+import LogParser
+
+
+'''
+Metrics of a simulation that is still running. LiveIngest follows COOJA.testlog as Cooja writes it: every poll reads the lines appended
+since the previous one, stores them through the run's record writer and feeds the tokenized families to RollingMetrics. When the
+simulation ends only the last lines are left to ingest, and a bad run (no traffic, a node without cells) shows up minutes earlier.
+'''
+class RollingMetrics:
+    def __init__(self, window=60000000, settle=10000000):
+        # Sliding window over the simulation time (us). The PDR is over the packets generated in [simTime - window - settle, simTime - settle],
+        # younger ones may still be in flight
+        self.window = window
+        self.settle = settle
+        self.lock = threading.Lock()
+        self.simTime = 0
+        self.generated = {} # (node, seqnum): generation time, of the packets still in the PDR window
+        self.generations = deque() # (generation time, (node, seqnum)) in log order, to drop them from generated
+        self.received = set() # The packets of generated that were received
+        self.generatedCount = 0
+        self.receivedCount = 0
+        self.latencies = deque() # (reception time, latency ms)
+        self.queues = deque() # (time, node, queued packets)
+        self.transmissions = deque() # (time, tx attempts)
+        self.cells = {} # node: scheduled slots
+
+    def update(self, families):
+        with self.lock:
+            for family in families.values():
+                if len(family['time']):
+                    self.simTime = max(self.simTime, int(family['time'][-1]))
+            app = families['app-generate']
+            for time, node, seqnum in zip(app['time'].tolist(), app['node'].tolist(), app['seqnum'].tolist()):
+                if (node, seqnum) not in self.generated:
+                    self.generated[(node, seqnum)] = time
+                    self.generations.append((time, (node, seqnum)))
+                    self.generatedCount += 1
+            app = families['app-receive']
+            for time, seqnum, src in zip(app['time'].tolist(), app['seqnum'].tolist(), app['src'].tolist()):
+                generated = self.generated.get((src, seqnum))
+                if generated is not None and (src, seqnum) not in self.received:
+                    self.received.add((src, seqnum))
+                    self.receivedCount += 1
+                    self.latencies.append((time, (time - generated) / 1000))
+            send = families['tsch-send']
+            self.queues.extend(zip(send['time'].tolist(), send['node'].tolist(), send['queue'].tolist()))
+            sent = families['tsch-sent']
+            self.transmissions.extend(zip(sent['time'].tolist(), sent['tx'].tolist()))
+            schedule = families['schedule']
+            for node, slot, action in zip(schedule['node'].tolist(), schedule['slot'].tolist(), schedule['action'].tolist()):
+                cells = self.cells.setdefault(node, set())
+                if action == 2:
+                    cells.discard(slot)
+                else:
+                    cells.add(slot)
+            start = self.simTime - self.window
+            for events in (self.latencies, self.queues, self.transmissions):
+                while events and events[0][0] < start:
+                    events.popleft()
+            while self.generations and self.generations[0][0] < start - self.settle:
+                time, key = self.generations.popleft()
+                del self.generated[key]
+                self.received.discard(key)
+
+    def status(self):
+        with self.lock:
+            settled = [key for time, key in self.generations if time <= self.simTime - self.settle]
+            latencies = np.array([latency for time, latency in self.latencies])
+            queues = np.array([queue for time, node, queue in self.queues])
+            tx = np.array([tx for time, tx in self.transmissions])
+            return {
+                'simTime': self.simTime,
+                'app-genPkg': self.generatedCount,
+                'app-rcvPkg': self.receivedCount,
+                'app-pdr': 100 * sum(key in self.received for key in settled) / len(settled) if settled else None,
+                'app-latency': float(latencies.mean()) if len(latencies) else None,
+                'app-latency-p90': float(np.percentile(latencies, 90)) if len(latencies) else None,
+                'mac-queue': float(queues.mean()) if len(queues) else None,
+                'mac-queue-max': int(queues.max()) if len(queues) else None,
+                'mac-retransRate': float((tx - 1).sum() / len(tx)) if len(tx) else None,
+                '6top-cells': sum(len(cells) for cells in self.cells.values()),
+                '6top-cellsByNode': {node: len(cells) for node, cells in sorted(self.cells.items())},
+                'window': self.window / 1000000,
+            }
+
+class LiveIngest:
+    def __init__(self, run, logFile, chunkSize=1 << 22, window=60000000):
+        self.run = run
+        self.logFile = logFile
+        self.chunkSize = chunkSize
+        self.offset = 0
+        self.partial = b''
+        self.count = 0
+        self.writer = run.recordWriter()
+        self.metrics = RollingMetrics(window)
+
+    def poll(self, final=False):
+        '''
+        Ingests the complete lines appended to the log, all of them when final. Runs on the thread that writes to the database
+        '''
+        try:
+            f = open(self.logFile, 'rb')
+        except OSError:
+            return self.count
+        with f:
+            f.seek(self.offset)
+            while True:
+                chunk = f.read(self.chunkSize)
+                if not chunk and not (final and self.partial):
+                    break
+                self.offset += len(chunk)
+                buffer = self.partial + chunk
+                cut = len(buffer) if final and not chunk else buffer.rfind(b'\n') + 1
+                self.partial = buffer[cut:]
+                if cut:
+                    lines, families = LogParser.toArrays(*LogParser.tokenize(buffer[:cut]))
+                    if len(lines[0]):
+                        self.writer.write(lines)
+                        self.count += len(lines[0])
+                    self.metrics.update(families)
+        return self.count
+
+    def close(self):
+        self.poll(final=True)
+        self.writer.close()
+        print("Run {} - {} records ingested (live)".format(self.run.id, self.count))
+        return self.count
+
+    def abort(self):
+        self.writer.close()
+        self.run.discard()
+
+    def status(self):
+        status = self.metrics.status()
+        status['records'] = self.count
+        return status
+
+class ConvergenceMonitor:
+    '''
+    Decides when a run reached its steady state: after the warm up, every metric stayed within tolerance (relative to its mean over
+    the window) for window seconds of simulation. The JobQueue then asks the Cooja script to stop (Experiment.prepareWorkDir stopFile).
+    The metrics are those of RollingMetrics.status, over its sliding window: app-pdr is the PDR of the packets of the last window and
+    not since the start, which would flatten more the longer the run and pass the check while the PDR still drifts
+    '''
+    def __init__(self, metrics=('app-pdr', 'app-latency', '6top-cells'), tolerance=0.05, window=120, warmUp=300):
+        self.metrics = list(metrics)
+        self.tolerance = tolerance
+        self.window = int(window * 1000000)
+        self.warmUp = int(warmUp * 1000000)
+        self.samples = deque() # (simTime, metric values)
+        self.reason = None
+        self.stopTime = None
+
+    def update(self, status):
+        '''
+        Takes a RollingMetrics status and returns True once the run converged
+        '''
+        if self.reason is not None:
+            return True
+        simTime = status['simTime']
+        if simTime < self.warmUp:
+            return False
+        values = [status.get(metric) for metric in self.metrics]
+        if any(value is None for value in values):
+            self.samples.clear()
+            return False
+        if self.samples and self.samples[-1][0] == simTime:
+            return False
+        self.samples.append((simTime, values))
+        # Keep one sample at or before the start of the window, so we know the whole window was observed
+        while len(self.samples) > 1 and self.samples[1][0] <= simTime - self.window:
+            self.samples.popleft()
+        if self.samples[0][0] > simTime - self.window:
+            return False
+        for i, metric in enumerate(self.metrics):
+            series = [values[i] for time, values in self.samples]
+            mean = sum(series) / len(series)
+            if max(series) - min(series) > self.tolerance * abs(mean):
+                return False
+        self.reason = "converged: {} within {:g}% for {:g} s".format(", ".join(self.metrics), self.tolerance * 100, self.window / 1000000)
+        self.stopTime = simTime
+        return True
@@ -0,0 +1,149 @@
+import re
+import numpy as np
+import pandas as pd
+
+'''
+Tokenizer for COOJA.testlog. It uses the compiled cooja_logparser extension (python3 setup.py build_ext --inplace) and falls back to the
+equivalent pure Python implementation below when it isn't built. Both return the same typed columns (see cooja_logparser.c).
+'''
+try:
+    import cooja_logparser
+except ImportError:
+    cooja_logparser = None
+
+ENERGEST_LABELS = ("CPU", "LPM", "Deep LPM", "Radio Rx", "Radio Tx", "Radio total")
+# DAG states of RPL Lite, the rpl-state "state" column is the index (-1 for other words)
+RPL_STATES = ("initialized", "joined", "reachable", "poisoning", "unknown")
+
+# Columns that don't fit in int32
+wideColumns = ('time', 'value', 'total')
+
+# Mote lines in COOJA.testlog: "<time> <node> [<level>: <type>] <data>"
+logLinePattern = re.compile(r'^(\d+)\s+(\d+)\s+\[([^:\]]*):([^\]]*)\]\s*(.*?)\s*$', re.ASCII)
+whitespace = ' \t\r\n\f\v'
+
+def parseLogLine(line):
+    '''
+    Returns (simTime, node, level, type, data) of a mote log line, or None for the logger's own lines and asserts
+    '''
+    res = logLinePattern.match(line)
+    if res is None:
+        return None
+    return (int(res.group(1)), int(res.group(2)), res.group(3).strip(whitespace), res.group(4).strip(whitespace), res.group(5))
+
+def lastGroup(addr):
+    return int(addr, 16) if addr is not None else -1
+
+address = r'(?:[0-9a-fA-F]*:)*([0-9a-fA-F]+)'
+
+# family: (record type, columns, pattern, pattern is searched instead of matched, converts the groups to the column values)
+families = {
+    'tsch-send': ('TSCH', ['dest', 'seqno', 'queue', 'queueSize', 'queueAll', 'queueAllSize', 'len', 'dataLen'],
+        r'send packet to ([0-9a-fA-F]+)\S* with seqno (\d+), queue (\d+)/(\d+) (\d+)/(\d+), len (\d+) (\d+)', False,
+        lambda g: (int(g[0], 16),) + tuple(int(v) for v in g[1:])),
+    'tsch-sent': ('TSCH', ['dest', 'seqno', 'status', 'tx'], r'packet sent to ([0-9a-fA-F]+)\S* seqno (\d+), status (\d+), tx (\d+)', False,
+        lambda g: (int(g[0], 16), int(g[1]), int(g[2]), int(g[3]))),
+    'tsch-received': ('TSCH', ['src', 'seqno'], r'received from ([0-9a-fA-F]+)\S* with seqno (\d+)', False,
+        lambda g: (int(g[0], 16), int(g[1]))),
+    'app-generate': ('App', ['seqnum'], r'app generate packet seqnum=(\d+) node_id=\d+', False,
+        lambda g: (int(g[0]),)),
+    'app-receive': ('App', ['seqnum', 'src'], r'app receive packet seqnum=(\d+) from=' + address + '$', False,
+        lambda g: (int(g[0]), int(g[1], 16))),
+    'rpl-links': ('RPL', ['child', 'parent'], r'links: +' + address + ' +to +' + address, False,
+        lambda g: (int(g[0], 16), int(g[1], 16))),
+    'rpl-parent-switch': ('RPL', ['parent'], r'parent switch: .*? -> (?:\(NULL IP addr\)|' + address + ')', False,
+        lambda g: (lastGroup(g[0]),)),
+    'rpl-state': ('RPL', ['rank', 'dioint', 'nbrs', 'state'], r'state: (\w*),.*? rank (\d+).*?dioint (\d+).*?nbr count (\d+)', True,
+        lambda g: (int(g[1]), int(g[2]), int(g[3]), RPL_STATES.index(g[0]) if g[0] in RPL_STATES else -1)),
+    'linkstats': ('Link Stats', ['tx', 'ack', 'rx', 'drops', 'to'], r'num packets: tx=(\d+) ack=(\d+) rx=(\d+) queue_drops=(\d+) to=([0-9a-fA-F]+)', False,
+        lambda g: (int(g[0]), int(g[1]), int(g[2]), int(g[3]), int(g[4], 16))),
+    'energest': ('Energest', ['kind', 'value', 'total'], r'(CPU|LPM|Deep LPM|Radio Rx|Radio Tx|Radio total)\s*:\s*(\d+)/\s*(\d+)', False,
+        lambda g: (ENERGEST_LABELS.index(g[0]), int(g[1]), int(g[2]))),
+    'schedule': ('6top', ['slot', 'action', 'peer'], r'RippleTrickle - sf-simple: (?:Schedule link (\d+) as (TX|RX) with node ([0-9a-fA-F]+)|Removing link (\d+))', False,
+        lambda g: (int(g[0]), 0 if g[1] == 'TX' else 1, int(g[2], 16)) if g[3] is None else (int(g[3]), 2, -1)),
+}
+familyPatterns = {family: (recordType, columns, re.compile(pattern, re.ASCII), search, convert) for family, (recordType, columns, pattern, search, convert) in families.items()}
+
+def columnType(column):
+    return np.int64 if column in wideColumns else np.int32
+
+def tokenizePython(buffer, records=True, families=True):
+    '''
+    Pure Python version of cooja_logparser.tokenize
+    '''
+    lines = ([], [], [], [], []) if records else None
+    found = {family: {column: [] for column in ['time', 'node'] + columns} for family, (recordType, columns, pattern, search, convert) in familyPatterns.items()}
+    for line in buffer.decode('utf-8', 'replace').split('\n'):
+        parsed = parseLogLine(line)
+        if parsed is None:
+            continue
+        simTime, node, level, recordType, data = parsed
+        for family, (familyType, columns, pattern, search, convert) in familyPatterns.items():
+            if not families or familyType != recordType:
+                continue
+            res = pattern.search(data) if search else pattern.match(data)
+            if res is None:
+                continue
+            values = found[family]
+            values['time'].append(simTime)
+            values['node'].append(node)
+            for column, value in zip(columns, convert(res.groups())):
+                values[column].append(value)
+            break
+        if records:
+            for column, value in zip(lines, parsed):
+                column.append(value)
+    if records:
+        lines = (np.array(lines[0], dtype=np.int64).tobytes(), np.array(lines[1], dtype=np.int32).tobytes(), lines[2], lines[3], lines[4])
+    if not families:
+        return lines, None
+    return lines, {family: {column: np.array(values, dtype=columnType(column)).tobytes() for column, values in columns.items()} for family, columns in found.items()}
+
+def tokenize(buffer, records=True, families=True):
+    if cooja_logparser is not None:
+        return cooja_logparser.tokenize(buffer, records, families)
+    return tokenizePython(buffer, records, families)
+
+def readChunks(logFile, chunkSize=1 << 22, records=True, families=True):
+    '''
+    Reads the log in chunks of whole lines and yields (bytes read, records, families) for each one, with the arrays already as numpy.
+    Without families (or records) that part of the result is None and isn't computed
+    '''
+    with open(logFile, 'rb') as f:
+        read = 0
+        tail = b''
+        while True:
+            chunk = f.read(chunkSize)
+            if not chunk:
+                break
+            read += len(chunk)
+            chunk = tail + chunk
+            cut = chunk.rfind(b'\n') + 1
+            tail = chunk[cut:]
+            yield read, *toArrays(*tokenize(chunk[:cut], records, families))
+        if tail:
+            yield read, *toArrays(*tokenize(tail, records, families))
+
+def toArrays(lines, found):
+    if lines is not None:
+        lines = (np.frombuffer(lines[0], dtype=np.int64), np.frombuffer(lines[1], dtype=np.int32), lines[2], lines[3], lines[4])
+    if found is None:
+        return lines, None
+    return lines, {family: {column: np.frombuffer(values, dtype=columnType(column)) for column, values in columns.items()} for family, columns in found.items()}
+
+def tokenizeLines(lines):
+    '''
+    Families of lines already split as (simTime, node, level, type, data), ex: the records of a run, written back as log lines
+    '''
+    buffer = "".join(["{} {} [{}: {}] {}\n".format(*line) for line in lines]).encode()
+    return toArrays(*tokenize(buffer, False, True))[1]
+
+def parseLog(logFile="COOJA.testlog"):
+    '''
+    Returns a DataFrame per message family with its numeric fields, e.g. parseLog()['tsch-sent'] has time, node, dest, seqno, status and tx
+    '''
+    parts = {family: [] for family in families}
+    for read, lines, found in readChunks(logFile, records=False):
+        for family, columns in found.items():
+            parts[family].append(pd.DataFrame(columns))
+    return {family: pd.concat(frames, ignore_index=True) if frames else pd.DataFrame() for family, frames in parts.items()}
@@ -21,15 +21,21 @@ from sqlalchemy.ext.mutable import MutableList
 matplotlib.use('Agg')
 import threading
 import itertools
+from collections import namedtuple
 import pandas as pd
+import numpy as np
 
 from sqlalchemy.sql.elements import TextClause
-from Runner import Runner
+from Runner import Runner, NativeRunner
+from BuildCache import BuildCache
+import LogParser
+from LatencyHistogram import LatencyHistogram
 from sqlalchemy import create_engine, MetaData, ForeignKey, Column, Integer, String, Float, DateTime, Boolean, engine
 from sqlalchemy.orm import relationship
 #Para realizar as alterações/consultas
-from sqlalchemy.orm import sessionmaker
-from sqlalchemy import func, inspect
+from sqlalchemy.orm import sessionmaker, scoped_session
+from sqlalchemy import func, inspect, Index, event, Table
+from sqlalchemy.pool import StaticPool
 from sqlalchemy import create_engine, MetaData
 from sqlalchemy.ext.declarative import declarative_base
 from sqlalchemy.orm import sessionmaker
@@ -43,16 +49,164 @@ from sqlalchemy import orm
 DBName = "Metrics.db"
 fileEngine = create_engine('sqlite:///' + DBName, connect_args={'check_same_thread': False}, echo = False)
 
-DBMemory = ":memory:"
-memEngine = create_engine('sqlite:///' + DBMemory, connect_args={'check_same_thread': False}, echo = False)
-memConnection = memEngine.raw_connection().connection
+# Set on every connection to DBName. WAL lets the web pages read while a run is being ingested, and NORMAL sync is safe with WAL
+SQLitePragmas = {"journal_mode": "WAL", "synchronous": "NORMAL", "cache_size": "-65536", "temp_store": "MEMORY", "busy_timeout": "30000"}
+
+@event.listens_for(fileEngine, "connect")
+def setSQLitePragmas(connection, record):
+    cursor = connection.cursor()
+    for pragma, value in SQLitePragmas.items():
+        cursor.execute("PRAGMA {}={}".format(pragma, value))
+    cursor.close()
+
 engine = fileEngine
 
+# Optional read replica for the listing pages of api.py: a snapshot of DBName (a file name or ":memory:") refreshed by refreshReplica
+DBReplica = os.environ.get("RT_DB_REPLICA")
+if DBReplica == ":memory:":
+    replicaEngine = create_engine('sqlite://', connect_args={'check_same_thread': False}, poolclass=StaticPool, echo = False)
+elif DBReplica:
+    replicaEngine = create_engine('sqlite:///' + DBReplica, connect_args={'check_same_thread': False}, echo = False)
+else:
+    replicaEngine = None
+
+# Where the parsed log lines of new runs go: "sqlite" (records table) or "parquet" (one columnar file per run in RecordStoreDir)
+RecordStore = os.environ.get("RT_RECORD_STORE", "sqlite")
+RecordStoreDir = "records"
+
+# Simulations run at the same time by Experiment.bulkRun, each one in its own work directory
+BulkConcurrency = int(os.environ.get("RT_BULK_CONCURRENCY", "1"))
+# Simulations given to each Cooja invocation by Experiment.bulkRun (see Runner.runBatch)
+BulkBatchSize = int(os.environ.get("RT_BULK_BATCH", "1"))
+
+# Simulations run at the same time by the JobQueue, each in JobDir/<job id>
+JobSlots = int(os.environ.get("RT_JOB_SLOTS", "1"))
+JobDir = "jobs"
+
+# What the Cooja logger script of the work dirs writes to COOJA.testlog (see configureLogger): all the mote output ("all"), only the
+# records the metrics read ("filter"), or those with the Link Stats and Energest reports added up per node in the simulation ("aggregate")
+LoggerMode = os.environ.get("RT_LOGGER_MODE", "all")
+# Families kept by the filtered logger besides the metric layers' ones: LiveMetrics follows the 6top schedule
+LoggerFamilies = {'schedule': ('6top', 'RippleTrickle - sf-simple:', None)}
+
+# Run settings that prepareWorkDir applies to the Makefile (RT_SCHEDULER) or the .csc (randomseed, TIMEOUT in ms) instead of project-conf.h
+WorkDirSettings = ('RT_SCHEDULER', 'randomseed', 'TIMEOUT')
+# project-conf.h overrides of each RT_SCHEDULER, the flat ProjectConfFile loses the #if of project-conf.h. Orchestra and the minimal
+# schedule run the stock RPL and TSCH, without the RippleTrickle scheduling function
+SchedulerDefines = {
+    'rippletrickle': {},
+    'orchestra': {'RPL_CONF_WITH_RIPPLETRICKLE': 0, 'RPL_CALLBACK_PARENT_SWITCH': 'tsch_rpl_callback_parent_switch'},
+    'minimal': {'RPL_CONF_WITH_RIPPLETRICKLE': 0, 'RPL_CALLBACK_PARENT_SWITCH': 'tsch_rpl_callback_parent_switch'},
+}
+
+# Latency histograms of each run (see Latency.getHistograms): time window (s) of the 'window' dimension and the tail percentiles reported
+LatencyWindow = 60
+LatencyQuantiles = (90, 99, 99.9)
+
+# Bump when a change in the metric code makes the stored results (e.g. cached plots) stale
+METRIC_VERSION = 4
+PlotCacheDir = "plots"
+
 meta = MetaData()
 meta.bind = engine
 Base = declarative_base(metadata=meta)
 Session = sessionmaker(bind=engine)
-db = Session()
+# One session per thread: Flask request threads, the JobQueue dispatcher and bulkRun don't share objects or transactions.
+# api.py removes the request's session when the request ends
+db = scoped_session(Session)
+# Session for pages that can live with the last replica snapshot, the main database when there is no replica
+readDb = scoped_session(sessionmaker(bind=replicaEngine)) if replicaEngine is not None else db
+
+# Lightweight view of a Record row, used by the metric code instead of ORM objects
+LogLine = namedtuple('LogLine', ['simTime', 'node', 'recordLevel', 'recordType', 'rawData'])
+
+class SQLiteRecordWriter:
+    '''
+    Writes parsed log lines to the records table through SQLAlchemy Core, committing each chunk so readers never wait on a whole run
+    '''
+    def __init__(self, run):
+        self.run = run
+        self.insert = Record.__table__.insert()
+
+    def write(self, lines):
+        simTime, node, level, recordType, data = lines
+        db.connection().execute(self.insert, [{'simTime': t, 'node': n, 'recordLevel': l, 'recordType': y, 'rawData': d, 'run_id': self.run.id} for t, n, l, y, d in zip(simTime.tolist(), node.tolist(), level, recordType, data)])
+        db.commit()
+
+    def close(self):
+        db.expire(self.run, ['records'])
+
+class ParquetRecordWriter:
+    '''
+    Writes parsed log lines to a zstd compressed Parquet file with typed columns. The file is referenced by Run.recordFile.
+    Families aren't stored, the records are classified when they're read (see Metrics.scan), so files stay valid when families change
+    '''
+    def __init__(self, run):
+        import pyarrow as pa
+        import pyarrow.parquet as pq
+        self.pa = pa
+        self.schema = pa.schema([('simTime', pa.int64()), ('node', pa.int32()), ('recordLevel', pa.string()), ('recordType', pa.string()), ('rawData', pa.string())])
+        os.makedirs(RecordStoreDir, exist_ok=True)
+        self.path = os.path.join(RecordStoreDir, "run-{}.parquet".format(run.id))
+        self.writer = pq.ParquetWriter(self.path, self.schema, compression='zstd')
+        run.recordFile = self.path
+
+    def write(self, lines):
+        self.writer.write_table(self.pa.Table.from_arrays([self.pa.array(c, type=f.type) for c, f in zip(lines, self.schema)], schema=self.schema))
+
+    def close(self):
+        self.writer.close()
+
+def readRecordFile(path, recordTypes=None):
+    '''
+    Yields the LogLines of a run stored as Parquet, reading only the LogLine columns and, if given, the rows of those record types.
+    Files written before the family column was dropped are read the same way
+    '''
+    import pyarrow.parquet as pq
+    filters = [('recordType', 'in', list(recordTypes))] if recordTypes else None
+    table = pq.read_table(path, columns=list(LogLine._fields), filters=filters)
+    columns = [table.column(c).to_pylist() for c in LogLine._fields]
+    return (LogLine(*row) for row in zip(*columns))
+
+class RecordDispatcher:
+    '''
+    Routes every record of a run, in a single scan, to the record families registered by the metric layers.
+    Each layer declares its families in recordFamilies as {family: (recordType, prefix, contains)}, None meaning "any".
+    The prefix can be a tuple of prefixes, as accepted by str.startswith.
+    '''
+    def __init__(self, layers):
+        self.families = []
+        self.recordFamilies = {}
+        self.byType = {}
+        self.anyType = []
+        for layer in layers:
+            for family, (recordType, prefix, contains) in layer.recordFamilies.items():
+                self.families.append(family)
+                self.recordFamilies[family] = (recordType, prefix, contains)
+                route = (family, prefix, contains)
+                if recordType is None:
+                    self.anyType.append(route)
+                else:
+                    self.byType.setdefault(recordType, []).append(route)
+        for routes in self.byType.values():
+            routes.extend(self.anyType)
+
+    def recordTypes(self):
+        '''
+        The record types some family reads, None when a family takes any type
+        '''
+        return None if self.anyType else list(self.byType)
+
+    def dispatch(self, lines) -> dict:
+        buckets = {family: [] for family in self.families}
+        for line in lines:
+            for family, prefix, contains in self.byType.get(line.recordType, self.anyType):
+                if prefix is not None and not line.rawData.startswith(prefix):
+                    continue
+                if contains is not None and contains not in line.rawData:
+                    continue
+                buckets[family].append(line)
+        return buckets
 
 class Experiment(Base):
     '''
@@ -71,25 +225,38 @@ class Experiment(Base):
     experimentFile = Column(String (200), nullable=False)
     confFile_id = Column(Integer, ForeignKey('projectconf.id'))
     confFile = relationship("ProjectConfFile", uselist=False)
-    def run(self):
-        runner = Runner(str(self.experimentFile))
+    def run(self, native=False):
+        '''
+        Runs the experiment once. With native=True the motes run as Linux processes (NativeRunner) instead of Cooja
+        '''
+        if native:
+            runner = NativeRunner(str(self.experimentFile))
+        else:
+            runner = Runner(str(self.experimentFile))
         newRun = Run()
-        newRun.maxNodes = len(minidom.parse(self.experimentFile).getElementsByTagName('id'))+1 #To use the node.id directly untedns
+        simFile = minidom.parse(self.experimentFile)
+        newRun.maxNodes = len(simFile.getElementsByTagName('id'))+1 #To use the node.id directly untedns
+        newRun.sinks = sinkCount(simFile)
+        newRun.loggerMode, newRun.loggedFamilies = loggerConfig(simFile.getElementsByTagName('script')[0].firstChild.data)
         newRun.experiment = self
         newRun.start = datetime.now()
         try:
             runner.run()
             newRun.end = datetime.now()
+            db.add(newRun)
             newRun.processRun()
-            newRun.parameters = newRun.getParameters()
+            newRun.setParameters(newRun.getParameters())
             self.runs.append(newRun)
             newRun.metric = Metrics(newRun)
-            db.add(newRun)
+            db.add(newRun.metric) # Backrefs don't cascade into the session on SQLAlchemy 2.0
             db.commit()
             newRun.metric.application.process()
+            newRun.summarize()
+            db.commit()
             return "Done"
         except Exception as ex:
             print (ex)
+            newRun.discard()
             return "Error"
     
     def getTimeout(self):
@@ -101,112 +268,359 @@ class Experiment(Base):
         matches = re.search(pattern, simFileContents)
         return int(matches.group(1))
 
-    def bulkRun(self, dictVariations, repetitions):
+    def bulkRun(self, dictVariations, repetitions, concurrency=None, batchSize=None):
         '''
         bulkRun was made for perform various run by variation of project.conf parameters. You have to pass a dict with a project.conf defines variations ex: dictVariations = {'TSCH_SCHEDULE_CONF_DEFAULT_LENGTH': [5,7,9], 'APP_SEND_INTERVAL_SEC': [1,3,5]} and the number of repetitions
+
+        Each run gets its own temp/<n> folder (project-conf.h, .csc with a new random seed and Cooja logs) and up to concurrency runs (default BulkConcurrency) are simulated at the same time. Only this thread writes to the database, as runs finish.
+        Firmware builds are reused through BuildCache: each configuration is built once, before its runs, and they all start from that build folder.
+        With batchSize (default BulkBatchSize) above 1, the runs ready at the same time are given to Cooja in batches, one JVM per batch.
         '''
         keys, values = zip(*dictVariations.items())
         permutations_dicts = [dict(zip(keys, v)) for v in itertools.product(*values)]
         for i in permutations_dicts:
             for k in i.keys():
-                self.confFile.defines[k] =  i[k]
-            # Creating temp folder
-            import os
-            import shutil
-            if os.path.isdir("temp"):
-                shutil.rmtree("temp")
-            os.mkdir("temp")
-            #copying files
-            shutil.copy(self.experimentFile, "temp")
-            shutil.copy("Makefile","temp")
-            # TODO: I Should get the mote.c file via .csc file
-            shutil.copy("node-rt.c","temp")
-            shutil.copy("sf-simple-rt.h","temp")
-            shutil.copy("sf-simple-rt.c","temp")
-            self.confFile.save("temp/project-conf.h")
-            #Adjsting the Makefile for the Contiki's right place
-            with open('temp/Makefile','r') as file:
-                filedata = file.read()
-                filedata = filedata.replace('../..','../../..')
-            with open('temp/Makefile','w') as file:
-                file.write(filedata)
+                if self.confFile is not None and k not in WorkDirSettings:
+                    self.confFile.defines[k] =  i[k]
+        status, runs = self.runDefines([i for i in permutations_dicts for run in range(repetitions)], concurrency, batchSize)
+        return status
+
+    def runDefines(self, definesList, concurrency=None, batchSize=None):
+        '''
+        Simulates one run per dict of project-conf.h overrides (and WorkDirSettings) in definesList, the way bulkRun does.
+        Returns the status and the new Runs in the order of definesList, None for the runs that failed
+        '''
+        from concurrent.futures import ThreadPoolExecutor, wait, FIRST_COMPLETED
+        import shutil
+        if os.path.isdir("temp"):
+            shutil.rmtree("temp")
+        os.mkdir("temp")
+        workDirs = []
+        for defines in definesList:
+            workDir = os.path.join("temp", str(len(workDirs)))
+            self.prepareWorkDir(workDir, defines)
+            workDirs.append(workDir)
+        runs = [None] * len(workDirs)
+        simFile = os.path.basename(self.experimentFile)
+        cache = BuildCache()
+        keys = {workDir: cache.key(workDir, os.path.join(workDir, simFile)) for workDir in workDirs}
+        waiting = {} # Runs waiting for the build of their key
+        builds = {} # BuildCache.build future: key
+        running = {}
+        ready = []
+        batchSize = batchSize or BulkBatchSize
+        status = "Done"
+        done = 0
+        with ThreadPoolExecutor(max_workers=concurrency or BulkConcurrency) as pool:
+            def submit():
+                while ready:
+                    batch = ready[:batchSize]
+                    del ready[:batchSize]
+                    running[pool.submit(Experiment.simulate, [os.path.join(workDir, simFile) for workDir in batch], batch)] = batch
+            # Each key is built once, in the folder of its first run, then all its runs start
+            for workDir in workDirs:
+                key = keys[workDir]
+                if key in waiting:
+                    waiting[key].append(workDir)
+                elif cache.restore(key, workDir):
+                    ready.append(workDir)
+                else:
+                    waiting[key] = [workDir]
+                    builds[pool.submit(cache.build, key, workDir, os.path.join(workDir, simFile))] = key
+            submit()
+            while running or builds:
+                finished, pending = wait(set(running) | set(builds), return_when=FIRST_COMPLETED)
+                results = []
+                batches = []
+                for future in finished:
+                    if future in builds:
+                        key = builds.pop(future)
+                        try:
+                            built = future.result()
+                        except Exception as ex:
+                            built = False
+                            print("Build of {} raised {!r}".format(waiting[key][0], ex))
+                        if not built:
+                            print("Build failed in {}, its runs build the firmware in Cooja".format(waiting[key][0]))
+                        for workDir in waiting.pop(key):
+                            if built:
+                                cache.restore(key, workDir)
+                            ready.append(workDir)
+                        continue
+                    batch = running.pop(future)
+                    batches.append(batch)
+                    try:
+                        results.extend(future.result())
+                    except Exception as ex:
+                        # Counted as failed simulations, the other batches go on
+                        print("Simulation of {} raised {!r}".format(", ".join(batch), ex))
+                        results.extend((workDir, None, None, False) for workDir in batch)
+                # Start the next runs before ingesting, so the workers don't sit idle
+                for workDir, start, end, ok in results:
+                    if ok:
+                        cache.store(keys[workDir], workDir) # When Cooja had to build it
+                submit()
+                for workDir, start, end, ok in results:
+                    key = keys[workDir]
+                    done += 1
+                    print("Bulk run {} of {} finished ({})".format(done, len(workDirs), workDir))
+                    if not ok:
+                        print("Simulation failed, keeping " + workDir)
+                        status = "Error"
+                        continue
+                    try:
+                        runs[workDirs.index(workDir)] = self.ingest(workDir, start, end, cache, key)
+                        shutil.rmtree(workDir)
+                    except Exception as ex:
+                        print (ex)
+                        db.rollback()
+                        status = "Error"
+                # The Cooja log of a batch (see simulate) is kept only along with the folders of its failed runs
+                for batch in batches:
+                    if len(batch) > 1 and not any(os.path.isdir(workDir) for workDir in batch):
+                        shutil.rmtree(batch[0] + "-batch", ignore_errors=True)
+        return status, runs
+
+    def ingest(self, workDir, start, end, cache=None, key=None, live=None):
+        '''
+        Stores the simulation finished in workDir as a new Run with its records, parameters, metrics and summary.
+        Called by bulkRun and JobQueue on the thread that writes to the database. With a LiveIngest that followed the simulation,
+        its run is used and only the end of the log is left to read
+        '''
+        newRun = live.run if live is not None else Run()
+        simFile = minidom.parse(os.path.join(workDir, os.path.basename(self.experimentFile)))
+        newRun.maxNodes = len(simFile.getElementsByTagName('id'))+1 #To use the node.id directly untedns
+        newRun.sinks = sinkCount(simFile)
+        newRun.loggerMode, newRun.loggedFamilies = loggerConfig(simFile.getElementsByTagName('script')[0].firstChild.data)
+        newRun.experiment = self
+        newRun.start = start
+        newRun.end = end
+        db.add(newRun)
+        try:
+            if live is not None:
+                live.close()
+            else:
+                newRun.processRun(os.path.join(workDir, "COOJA.testlog"))
+            newRun.setParameters(newRun.getBulkParameters(workDir, cache, key))
+            self.runs.append(newRun)
+            newRun.metric = Metrics(newRun)
+            db.add(newRun.metric) # Backrefs don't cascade into the session on SQLAlchemy 2.0
+            db.commit()
+            newRun.metric.application.process()
+            newRun.summarize()
+            db.commit()
+        except Exception:
+            newRun.discard()
+            raise
+        return newRun
+
+    def enqueue(self, defines=None, priority=0, convergence=None):
+        '''
+        Adds a run of this experiment to the jobs table, to be simulated by the JobQueue. defines overrides project-conf.h for this run only.
+        convergence (a dict of ConvergenceMonitor arguments, {} for the defaults) ends the run early once its metrics settle
+        '''
+        job = Job(experiment=self, defines=dict(defines) if defines else None, priority=priority, convergence=convergence, state='queued', created=datetime.now())
+        db.add(job)
+        db.commit()
+        return job
+
+    def enqueueBulk(self, dictVariations, repetitions, priority=0, convergence=None):
+        '''
+        Same permutations as bulkRun, but each run is a job of its own, so the sweep survives restarts and can be cancelled run by run
+        '''
+        keys, values = zip(*dictVariations.items())
+        jobs = []
+        for v in itertools.product(*values):
             for run in range(repetitions):
-                # Generate a new randomseed for each run
-                import lxml.etree
-                import random
-                simFile = lxml.etree.parse(str("temp/" + self.experimentFile))
-                rand = simFile.xpath("//randomseed")[0]
-                rand.text = str(random.randint(0,65535))
-                open(str("temp/" + self.experimentFile), 'w').write(lxml.etree.tounicode(simFile))
-                #End Generate a new randomseed for each run
-                runner = Runner(str("temp/" + self.experimentFile))
-                newRun = Run()
-                newRun.maxNodes = len(minidom.parse("temp/" + self.experimentFile).getElementsByTagName('id'))+1 #To use the node.id directly untedns
-                newRun.experiment = self
-                newRun.start = datetime.now()
-                try:
-                    runner.run()
-                    newRun.end = datetime.now()
-                    newRun.processRun()
-                    newRun.parameters = newRun.getBulkParameters()
-                    self.runs.append(newRun)
-                    newRun.metric = Metrics(newRun)
-                    db.add(newRun)
-                    db.commit()
-                    newRun.metric.application.process()
-                    #continue
-                except Exception as ex:
-                    print (ex)
-                    return "Error"
-
-    def toCsv(self, filename):
-        '''
-        Its a personal demanding for my experiements. In my experiments I have run with SlotFrame length [5,7 and 11] and APP_SEDD_INTERVAL of [3600(No App data), 1, 2, 3, 4, 5]
-        '''
-        self = self
-        sfLen = ['11','19','33']
-        sendInterval = ['2','3','4','5','6']
-        dataset = {}
-        dados = []
-        runs = len(self.runs)
-        for r in self.runs:
-            dataset[self.experimentFile] = {}
-            for sf in sfLen:
-                dataset[str(self.experimentFile)][sf] = {}
-                for s in sendInterval:
-                    dataset[str(self.experimentFile)][sf][s] = []
-        for r in self.runs:
-            for sf in sfLen:
-                if r.parameters['TSCH_SCHEDULE_CONF_DEFAULT_LENGTH'] == sf:
-                    #Put Here your metrics
-                    print(self.name + ' - extracting data from run ' , r.id , ' of ' , runs , ' > SF Length ' + r.parameters['TSCH_SCHEDULE_CONF_DEFAULT_LENGTH'] + ' > Send Interval ' + r.parameters['APP_SEND_INTERVAL_SEC'], end='\r')
-                    dataset[str(self.experimentFile)][r.parameters['TSCH_SCHEDULE_CONF_DEFAULT_LENGTH']][r.parameters['APP_SEND_INTERVAL_SEC']].append(r.metric.getSummary())
-            r.records = []
+                jobs.append(Job(experiment=self, defines=dict(zip(keys, v)), priority=priority, convergence=convergence, state='queued', created=datetime.now()))
+        db.add_all(jobs)
+        db.commit()
+        return jobs
+
+    def prepareWorkDir(self, workDir, defines=None, stopFile=None, loggerMode=None):
+        '''
+        Copies the scenario, firmware sources and the current project-conf.h (with the defines overrides) to workDir, with a new random seed in the .csc.
+        With stopFile, the logger script ends the simulation as soon as that file exists (see ConvergenceMonitor).
+        The logger script is set up for loggerMode, LoggerMode by default (see configureLogger).
+        The WorkDirSettings in defines go to the Makefile and the .csc instead: RT_SCHEDULER picks the scheduler build, randomseed
+        replaces the random one, so the same seed can be simulated under each scheduler, and TIMEOUT (ms) shortens or extends the run
+        '''
+        import shutil
+        import lxml.etree
+        import random
+        defines = dict(defines or {})
+        settings = {key: defines.pop(key) for key in WorkDirSettings if key in defines}
+        if 'RT_SCHEDULER' in settings:
+            if settings['RT_SCHEDULER'] not in SchedulerDefines:
+                raise ValueError("Unknown RT_SCHEDULER " + str(settings['RT_SCHEDULER']))
+            defines = dict(SchedulerDefines[settings['RT_SCHEDULER']], **defines)
+        os.mkdir(workDir)
+        #copying files
+        shutil.copy(self.experimentFile, workDir)
+        shutil.copy("Makefile", workDir)
+        # TODO: I Should get the mote.c file via .csc file
+        shutil.copy("node-rt.c", workDir)
+        shutil.copy("sf-simple-rt.h", workDir)
+        shutil.copy("sf-simple-rt.c", workDir)
+        shutil.copy("native-radio-rt.c", workDir) # For NativeRunner
+        if self.confFile is not None:
+            self.confFile.save(os.path.join(workDir, "project-conf.h"), defines)
+        else:
+            shutil.copy("project-conf.h", workDir)
+            with open(os.path.join(workDir, "project-conf.h"), "a") as file:
+                for k, v in (defines or {}).items():
+                    file.write("#undef " + k + "\n#define " + k + " " + str(v) + "\n")
+        #Adjsting the Makefile for the Contiki's right place, absolute so the folder depth doesn't matter
+        with open(os.path.join(workDir, 'Makefile'), 'r') as file:
+            filedata = file.read()
+            filedata = filedata.replace('../..', os.path.abspath('../..'))
+            if 'RT_SCHEDULER' in settings:
+                filedata = "RT_SCHEDULER = " + settings['RT_SCHEDULER'] + "\n" + filedata
+        with open(os.path.join(workDir, 'Makefile'), 'w') as file:
+            file.write(filedata)
+        # Generate a new randomseed for each run
+        simPath = os.path.join(workDir, os.path.basename(self.experimentFile))
+        simFile = lxml.etree.parse(simPath)
+        rand = simFile.xpath("//randomseed")[0]
+        rand.text = str(settings.get('randomseed', random.randint(0,65535)))
+        script = simFile.xpath("//plugin_config/script")[0]
+        if 'TIMEOUT' in settings:
+            script.text = re.sub(r'TIMEOUT\(\d+\)', 'TIMEOUT({})'.format(int(settings['TIMEOUT'])), script.text, count=1)
+        if stopFile is not None:
+            script.text = addStopCheck(script.text, os.path.abspath(stopFile))
+        script.text = configureLogger(script.text, loggerMode or LoggerMode)
+        open(simPath, 'w').write(lxml.etree.tounicode(simFile))
+
+    def getWarmUp(self, defines=None):
+        '''
+        APP_WARM_UP_PERIOD_SEC of a run with these overrides, in seconds
+        '''
+        values = dict(self.confFile.defines) if self.confFile is not None else {}
+        values.update(defines or {})
+        try:
+            return float(values.get('APP_WARM_UP_PERIOD_SEC', 300))
+        except ValueError:
+            return 300.0
+
+    @staticmethod
+    def simulate(simFiles, workDirs):
+        '''
+        Runs Cooja for bulkRun scenarios, one invocation for all of them, and returns (workDir, start, end, succeeded) for each one.
+        It runs on the worker threads, so it doesn't touch the session
+        '''
+        start = datetime.now()
+        if len(simFiles) == 1:
+            results = [Runner(simFiles[0], workDir=workDirs[0]).run() == 0]
+        else:
+            batchDir = workDirs[0] + "-batch"
+            os.makedirs(batchDir, exist_ok=True)
+            results = Runner(simFiles[0], workDir=batchDir).runBatch(simFiles)
+        end = datetime.now()
+        return [(workDir, start, end, ok) for workDir, ok in zip(workDirs, results)]
+
+    def getSummaries(self):
+        '''
+        Returns (run id, parameters, summary dict) of every run with metrics, in a single query on run_summary.
+        Runs without a summary or with one from an older METRIC_VERSION are summarized first
+        '''
+        stale = db.query(Run).join(Metrics, Metrics.run_id == Run.id).outerjoin(RunSummary, RunSummary.run_id == Run.id).filter(Run.experiment_id == self.id, (RunSummary.id == None) | (RunSummary.metricVersion != METRIC_VERSION)).all()
+        for i, r in enumerate(stale):
+            print(self.name + ' - summarizing run ', r.id, ' (', i + 1, ' of ', len(stale), ')', end='\r')
+            r.summarize()
+            db.commit()
+        parameters = dict(db.query(Run.id, Run.parameters).filter(Run.experiment_id == self.id))
+        rows = db.query(RunSummary).join(Run, RunSummary.run_id == Run.id).filter(Run.experiment_id == self.id).order_by(Run.id)
+        return [(summary.run_id, parameters[summary.run_id], summary.toDict()) for summary in rows]
+
+    def getSummaryFrame(self):
+        '''
+        One row per run with its parameters and summary metrics, the input of aggregate
+        '''
+        rows = []
+        for runId, parameters, summary in self.getSummaries():
+            row = {'run': runId}
+            row.update(parameters or {})
+            row.update(summary)
+            rows.append(row)
+        return pd.DataFrame(rows)
+
+    def aggregate(self, groupBy, metrics=None, percentiles=(50, 90, 99)):
+        '''
+        Groups the runs by any run parameters (ex: ['TSCH_SCHEDULE_CONF_DEFAULT_LENGTH', 'APP_SEND_INTERVAL_SEC']) and returns, for each
+        summary metric (default all of RunSummary.fields), its mean, std, count, 95% confidence interval half width and percentiles,
+        all in one groupby over the run_summary rows. Columns are named <metric>-<statistic>
+        '''
+        metrics = list(metrics or RunSummary.fields)
+        frame = self.getSummaryFrame()
+        if frame.empty:
+            return pd.DataFrame(columns=list(groupBy))
+        missing = [key for key in list(groupBy) + metrics if key not in frame.columns]
+        if missing:
+            raise KeyError("Unknown parameters or metrics: " + ", ".join(missing))
+        frame[metrics] = frame[metrics].apply(pd.to_numeric, errors='coerce')
+        grouped = frame.groupby(list(groupBy), sort=True)[metrics]
+        stats = {'mean': grouped.mean(), 'std': grouped.std(), 'count': grouped.count()}
+        # Normal approximation, there is no scipy here for the t distribution
+        stats['ci95'] = 1.96 * stats['std'] / stats['count'].pow(0.5)
+        for p in percentiles:
+            stats['p' + str(p)] = grouped.quantile(p / 100)
+        result = pd.concat(stats, axis=1)
+        result.columns = ['{}-{}'.format(metric, stat) for stat, metric in result.columns]
+        result = result[['{}-{}'.format(metric, stat) for metric in metrics for stat in stats]]
+        return result.reset_index()
+
+    def aggregateLatency(self, groupBy=(), dimension='all', quantiles=LatencyQuantiles):
+        '''
+        Tail latency of the runs grouped by run parameters, with the stored histograms of each group merged per key of dimension
+        ('all', 'node', 'hops' or 'window', see LatencyDistribution), so the quantiles pool every packet of the repetitions instead
+        of averaging per-run percentiles. One row per group and key with the packets, mean and quantiles (ms)
+        '''
+        groupBy = list(groupBy)
+        self.getSummaries() # Stores the histograms of the runs that were never summarized
+        parameters = dict(db.query(Run.id, Run.parameters).filter(Run.experiment_id == self.id))
+        rows = db.query(LatencyDistribution).join(Run, LatencyDistribution.run_id == Run.id).filter(Run.experiment_id == self.id,
+            LatencyDistribution.dimension == dimension)
+        merged = {}
+        for row in rows:
+            values = parameters[row.run_id] or {}
+            missing = [key for key in groupBy if key not in values]
+            if missing:
+                raise KeyError("Unknown parameters: " + ", ".join(missing))
+            group = tuple(values[key] for key in groupBy) + (row.key,)
+            entry = merged.setdefault(group, [LatencyHistogram(row.bits), set()])
+            entry[0].merge(row.toHistogram())
+            entry[1].add(row.run_id)
+        result = []
+        for group, (histogram, runs) in merged.items():
+            line = dict(zip(groupBy + [dimension], group))
+            line.update({'runs': len(runs), 'packets': histogram.total, 'mean': round(histogram.mean() / 1000, 3)})
+            for q, value in histogram.quantiles(quantiles).items():
+                line['p{:g}'.format(q)] = round(value / 1000, 3)
+            result.append(line)
+        result = pd.DataFrame(result, columns=groupBy + [dimension, 'runs', 'packets', 'mean'] + ['p{:g}'.format(q) for q in quantiles])
+        return result.sort_values(groupBy + [dimension]).reset_index(drop=True)
+
+    def exportAggregate(self, filename, groupBy, metrics=None, percentiles=(50, 90, 99)):
+        '''
+        Writes aggregate to filename, as Parquet when it ends with .parquet and CSV otherwise
+        '''
+        result = self.aggregate(groupBy, metrics, percentiles)
+        if filename.endswith(".parquet"):
+            result.to_parquet(filename, index=False)
+        else:
+            result.to_csv(filename, index=False)
+        return result
+
+    def toCsv(self, filename, groupBy=('TSCH_SCHEDULE_CONF_DEFAULT_LENGTH', 'APP_SEND_INTERVAL_SEC')):
+        '''
+        Writes the mean of every summary metric by groupBy (default SlotFrame length and APP_SEND_INTERVAL_SEC) to filename and the
+        standard deviation to "STD"+filename. See aggregate for the other statistics
+        '''
+        result = self.aggregate(groupBy, percentiles=())
+        for stat, name in (('mean', filename), ('std', "STD" + filename)):
+            columns = [column for column in result.columns if column.endswith('-' + stat)]
+            result[list(groupBy) + columns].rename(columns={column: column[:-len(stat) - 1] for column in columns}).to_csv(name, index=False)
         print("Done generating CSV")
-        for e in dataset.keys():
-            for sfleng in dataset[e].keys():
-                for sentInt in dataset[e][sfleng].keys():
-                    df = pd.DataFrame(dataset[e][sfleng][sentInt])
-                    data = {}
-                    data['SlotFrame Length'] = sfleng
-                    data['Sent Interval'] = sentInt
-                    data.update(json.loads(df.mean().to_json()))
-                    dados.append(data)
-                    del data
-        df = pd.json_normalize(dados) 
-        df.to_csv(filename)
-        dados = []
-        for e in dataset.keys():
-            for sfleng in dataset[e].keys():
-                for sentInt in dataset[e][sfleng].keys():
-                    df = pd.DataFrame(dataset[e][sfleng][sentInt])
-                    data = {}
-                    data['SlotFrame Length'] = sfleng
-                    data['Sent Interval'] = sentInt
-                    data.update(json.loads(df.std().to_json()))
-                    dados.append(data)
-        df = pd.json_normalize(dados)         
-        df.to_csv("STD"+filename)      
 
 class Run(Base):
     '''
@@ -216,6 +630,7 @@ class Run(Base):
             start: Start simulation time
             end: End simulation time
             maxNodes: Simulation nodes amount
+            sinks: Nodes 1..sinks are the sinks (APP_SINK_COUNT)
             parameters: Run parameters
             experiment: Experiment base
             metric: Metrics simulation
@@ -225,10 +640,19 @@ class Run(Base):
     start = Column(DateTime)
     end = Column(DateTime)
     maxNodes = Column(Integer)
+    sinks = Column(Integer) # APP_SINK_COUNT the firmware was built with, None for the runs stored before it (a single sink)
     parameters = Column(PickleType)
+    recordFile = Column(String(200)) # Parquet file with the run records, when stored outside the records table
+    stopReason = Column(String(200)) # Why the simulation ended: "timeout" or the ConvergenceMonitor verdict
+    stopTime = Column(Integer) # Simulation time (us) of the stop
+    loggerMode = Column(String(20)) # Logger script mode of the simulation (see configureLogger)
+    loggedFamilies = Column(PickleType) # Record families the logger kept, None when it logged all the mote output
     experiment_id = Column(Integer, ForeignKey('experiments.id')) # The ForeignKey must be the physical ID, not the Object.id
     experiment = relationship("Experiment", back_populates="runs")
     metric = relationship("Metrics", uselist=False, back_populates="run")
+    summary = relationship("RunSummary", uselist=False, back_populates="run")
+    latencyHistograms = relationship("LatencyDistribution", back_populates="run", cascade="all, delete-orphan")
+    parameterValues = relationship("RunParameter", back_populates="run", cascade="all, delete-orphan")
 
     def __str__(self) -> str:
         layer = {}
@@ -281,6 +705,45 @@ class Run(Base):
         plt.savefig(tempBuffer, format = 'png')
         return base64.b64encode(tempBuffer.getvalue()).decode()
 
+    def summarize(self):
+        '''
+        Stores the Metrics summary in the run_summary table, or refreshes it when it was computed by another METRIC_VERSION
+        '''
+        if self.summary is None:
+            self.summary = RunSummary(self)
+            db.add(self.summary)
+            self.storeLatencyHistograms()
+        elif self.summary.metricVersion != METRIC_VERSION:
+            self.summary.update()
+            self.storeLatencyHistograms()
+        return self.summary
+
+    def storeLatencyHistograms(self):
+        '''
+        Replaces the stored latency histograms of the run by those of its records (Latency.getHistograms)
+        '''
+        self.latencyHistograms = [LatencyDistribution.fromHistogram(dimension, key, histogram)
+            for (dimension, key), histogram in self.metric.application.latency.getHistograms().items()]
+
+    def getLatencyHistograms(self, dimension='all'):
+        '''
+        {key: LatencyHistogram} of a dimension of the stored histograms: 'all' (key 0), 'node', 'hops' or 'window' (start in s)
+        '''
+        return {row.key: row.toHistogram() for row in self.latencyHistograms if row.dimension == dimension}
+
+    def getSummary(self):
+        '''
+        Same dict as Metrics.getSummary, read from run_summary instead of the records
+        '''
+        return self.summarize().toDict()
+
+    @property
+    def senders(self):
+        '''
+        Ids of the nodes that aren't sinks
+        '''
+        return range((self.sinks or 1) + 1, self.maxNodes)
+
     def getNodesPosition(self):
         myData = {}
         for i in range(2,(self.maxNodes)):
@@ -297,27 +760,36 @@ class Run(Base):
         return myData
 
 
-    def processRun(self):
-        with open("COOJA.testlog", "r") as f:
-            for line in f.readlines():
-                if (line.startswith("Random") or line.startswith("Starting") or line.startswith("Script timed out") or line.startswith("TEST OK")):
-                    continue
-                if (line.startswith("Test ended at simulation time:")):
-                    simTime = int(line.split(":")[1].strip())
-                    continue
-                fields = line.split()
-                logTime = fields[0]
-                logNode = int(fields[1])
-                if (fields[2].startswith("Assertion")):
-                    continue
-                logDesc = re.findall("\[(.*?)\]", line)[0].split(":")
-                logLevel = logDesc[0].strip()
-                logType = logDesc[1].strip()
-                data = line.split("]")[1].strip()
-                newRecord = Record(logTime,logNode,logLevel,logType,data,self)
-                #db.add(newRecord)
-                self.records.append(newRecord)
+    def processRun(self, logFile="COOJA.testlog", chunkSize=1 << 22):
+        '''
+        Streams the Cooja test log into the record store (see RecordStore). The log is tokenized in chunks of whole lines by LogParser and
+        each chunk is written, and committed, at once. Callers remove a run that fails half way with discard().
+        Only the records are tokenized, the metric layers read their families from the store (see Metrics.scan)
+        '''
+        writer = self.recordWriter()
+        total = os.path.getsize(logFile) or 1
+        count = 0
+        for read, lines, families in LogParser.readChunks(logFile, chunkSize, families=False):
+            if len(lines[0]) == 0:
+                continue
+            writer.write(lines)
+            count += len(lines[0])
+            print("Run {} - {} records ingested ({}%)".format(self.id, count, min(100, read * 100 // total)), end='\r')
+        writer.close()
+        print("Run {} - {} records ingested (100%)".format(self.id, count))
+        return count
     
+    def recordWriter(self):
+        '''
+        Returns the writer of the configured record store for this run, see processRun and LiveMetrics.LiveIngest
+        '''
+        if self.id is None:
+            db.add(self)
+            db.flush()
+        if RecordStore == "parquet":
+            return ParquetRecordWriter(self)
+        return SQLiteRecordWriter(self)
+
     def getParameters(self):
         '''
         Adapted from: https://stackoverflow.com/questions/2804543/read-subprocess-stdout-line-by-line
@@ -327,6 +799,7 @@ class Run(Base):
         myDict = {}
         for param in ['radiomedium','transmitting_range','interference_range','success_ratio_tx','success_ratio_rx']:
             myDict[param] = str(minidom.parse(self.experiment.experimentFile).getElementsByTagName(param)[0].firstChild.data).strip()
+        myDict['RT_SCHEDULER'] = getScheduler("Makefile")
         for line in iter(proc.stdout.readline,''):
             if not line:
                 break
@@ -343,15 +816,27 @@ class Run(Base):
                     continue
         return myDict
 
-    def getBulkParameters(self):
+    def getBulkParameters(self, workDir="temp", cache=None, key=None):
         '''
         Adapted from: https://stackoverflow.com/questions/2804543/read-subprocess-stdout-line-by-line
+
+        With a BuildCache and key, the viewconf output of that firmware configuration is parsed only once
         '''
         import subprocess
-        proc = subprocess.Popen(['make','viewconf'],bufsize=1, cwd="temp", universal_newlines=True, stdout=subprocess.PIPE)
         myDict = {}
+        simFile = minidom.parse(os.path.join(workDir, os.path.basename(self.experiment.experimentFile)))
         for param in ['randomseed','radiomedium','transmitting_range','interference_range','success_ratio_tx','success_ratio_rx']:
-            myDict[param] = str(minidom.parse(self.experiment.experimentFile).getElementsByTagName(param)[0].firstChild.data).strip()
+            myDict[param] = str(simFile.getElementsByTagName(param)[0].firstChild.data).strip()
+        myDict['RT_SCHEDULER'] = getScheduler(os.path.join(workDir, "Makefile"))
+        timeout = re.search(r"TIMEOUT\((\d+)\)", simFile.getElementsByTagName('script')[0].firstChild.data)
+        if timeout:
+            myDict['TIMEOUT'] = timeout.group(1)
+        viewconf = cache.loadParameters(key) if cache is not None else None
+        if viewconf is not None:
+            myDict.update(viewconf)
+            return myDict
+        viewconf = {}
+        proc = subprocess.Popen(['make','viewconf'],bufsize=1, cwd=workDir, universal_newlines=True, stdout=subprocess.PIPE)
         for line in iter(proc.stdout.readline,''):
             if not line:
                 break
@@ -359,13 +844,16 @@ class Run(Base):
                 line = line.split()
                 try:
                     #print (line[1].split("\"")[1] , "value", line [4])
-                    myDict[line[1].split("\"")[1]] = line [4]
+                    viewconf[line[1].split("\"")[1]] = line [4]
                 except IndexError:
                     if (line[1].split("\"")[1].startswith("MAKE")):
                         #print (line[1].split("\"")[1] , "value", line [3])
-                        myDict[line[1].split("\"")[1]] = line [3]
+                        viewconf[line[1].split("\"")[1]] = line [3]
                         continue
                     continue
+        if proc.wait() == 0 and cache is not None:
+            cache.storeParameters(key, viewconf)
+        myDict.update(viewconf)
         return myDict
 
     def getRunDuration(self) -> DateTime:
@@ -374,6 +862,321 @@ class Run(Base):
         '''
         return self.end - self.start
 
+    def discard(self):
+        '''
+        Removes a run whose ingestion failed, together with the records processRun already committed and the metric layers rows
+        '''
+        db.rollback()
+        runId = self.id
+        if runId is None or db.get(Run, runId) is None:
+            return
+        recordFile = self.recordFile
+        layers = db.query(Metrics.id, Metrics.mac_id, Metrics.rpl_id, Metrics.energy_id, Metrics.linkstats_id).filter(Metrics.run_id == runId).all()
+        applications = db.query(Application.id, Application.latency_id, Application.pdr_id).filter(Application.metric_id.in_([layer[0] for layer in layers])).all()
+        # Rows keyed on the metric layers, by id
+        owned = {Application: [app[0] for app in applications], Latency: [app[1] for app in applications], PDR: [app[2] for app in applications],
+            MAC: [layer[1] for layer in layers], RPL: [layer[2] for layer in layers], Energy: [layer[3] for layer in layers], LinkStats: [layer[4] for layer in layers],
+            Metrics: [layer[0] for layer in layers], Run: [runId]}
+        db.query(AppRecord).filter(AppRecord.application_id.in_(owned[Application])).delete(synchronize_session=False)
+        for table in (Record, RunParameter, RunSummary, LatencyDistribution):
+            db.query(table).filter(table.run_id == runId).delete(synchronize_session=False)
+        for table, ids in owned.items():
+            db.query(table).filter(table.id.in_([i for i in ids if i is not None])).delete(synchronize_session=False)
+        db.commit()
+        # SQLite reuses the ids of the last rows, the next run must not find these objects in the identity map
+        for (table, identity, token), obj in list(db.identity_map.items()):
+            if table in owned and identity[0] in owned[table]:
+                db.expunge(obj)
+        if recordFile and os.path.exists(recordFile):
+            os.remove(recordFile)
+        PlotCache().clear(runId)
+
+    def setParameters(self, parameters):
+        '''
+        Sets the parameters dict and its run_parameters rows, which are the ones used to filter runs in SQL (see withParameters)
+        '''
+        self.parameters = parameters
+        self.parameterValues = [RunParameter(key=key, value=str(value)) for key, value in parameters.items()]
+
+    @staticmethod
+    def withParameters(query=None, **parameters):
+        '''
+        Filters the runs by parameter values in SQL, ex: Run.withParameters(TSCH_SCHEDULE_CONF_DEFAULT_LENGTH='19').all()
+        '''
+        if query is None:
+            query = db.query(Run)
+        for key, value in parameters.items():
+            query = query.filter(Run.parameterValues.any((RunParameter.key == key) & (RunParameter.value == str(value))))
+        return query
+
+class RunParameter(Base):
+    '''
+    One row per run parameter, a copy of Run.parameters that can be queried and indexed
+    '''
+    __tablename__ = "run_parameters"
+    __table_args__ = (Index('ix_run_parameters_key_value', 'key', 'value', 'run_id'),)
+    id = Column(Integer, primary_key=True)
+    run_id = Column(Integer, ForeignKey('runs.id'), index=True, nullable=False)
+    run = relationship("Run", back_populates="parameterValues")
+    key = Column(String(100), nullable=False)
+    value = Column(String(200))
+
+def addStopCheck(script, stopFile):
+    '''
+    Makes a Cooja logger script end the test, with TEST OK, once stopFile exists. The file is checked once per simulated second
+    '''
+    check = (
+        "    if (time >= stop_check) {\n"
+        "        stop_check = time + 1000000;\n"
+        "        if (stop_file.exists()) {\n"
+        "            log.log(\"Script stopped early.\\n\");\n"
+        "            log.testOK();\n"
+        "        }\n"
+        "    }\n")
+    if "YIELD();" not in script:
+        print("The logger script has no YIELD(), it can't be stopped early")
+        return script
+    script = script.replace("    YIELD();", check + "    YIELD();", 1) if "    YIELD();" in script else script.replace("YIELD();", check + "YIELD();", 1)
+    return "stop_file = new java.io.File(\"" + stopFile + "\");\nstop_check = 0;\n" + script
+
+# Logger functions added by configureLogger. Cooja runs the script on Nashorn, so ES5 only (no startsWith, let or arrow functions)
+LoggerScript = r'''
+logger_line = /^\[([^:\]]*):([^\]]*)\]\s*(.*?)\s*$/;
+logger_link_stats = /^num packets: tx=(\d+) ack=(\d+) rx=(\d+) queue_drops=(\d+) to=(\S+)/;
+logger_energest = /^(.*?)\s*:\s*(\d+)\/\s*(\d+)/;
+logger_links = {};
+logger_energy = {};
+
+function logger_trim(text) {
+    return text.replace(/^\s+|\s+$/g, "");
+}
+
+function logger_wanted(type, data) {
+    var rules = (logger_rules[type] || []).concat(logger_rules["*"] || []);
+    for (var i = 0; i < rules.length; i++) {
+        if (rules[i][0] != null && data.lastIndexOf(rules[i][0], 0) != 0) continue;
+        if (rules[i][1] != null && data.indexOf(rules[i][1]) < 0) continue;
+        return true;
+    }
+    return false;
+}
+
+function logger_record(time, id, msg) {
+    var line = logger_line.exec(msg);
+    if (line == null) return;
+    var type = logger_trim(line[2]);
+    var data = line[3];
+    if (!logger_wanted(type, data)) return;
+    if (logger_aggregate && type == "Link Stats") {
+        var counters = logger_link_stats.exec(data);
+        if (counters != null) {
+            var link = logger_links[id + " " + counters[5]];
+            if (link == undefined) link = logger_links[id + " " + counters[5]] = {id: id, to: counters[5], counters: [0, 0, 0, 0]};
+            for (var i = 0; i < 4; i++) link.counters[i] += parseInt(counters[i + 1], 10);
+            return;
+        }
+    }
+    if (logger_aggregate && type == "Energest") {
+        var period = logger_energest.exec(data);
+        if (period != null && parseInt(period[3], 10) > 0) {
+            var energy = logger_energy[id + " " + period[1]];
+            if (energy == undefined) energy = logger_energy[id + " " + period[1]] = {id: id, label: period[1], sum: 0, reports: 0};
+            energy.sum += 100 * period[2] / period[3];
+            energy.reports++;
+            return;
+        }
+    }
+    log.log(time + " " + id + " " + msg + "\n");
+}
+
+function logger_flush() {
+    for (var key in logger_links) {
+        var link = logger_links[key];
+        log.log(time + " " + link.id + " [INFO: Link Stats] num packets: tx=" + link.counters[0] + " ack=" + link.counters[1] +
+            " rx=" + link.counters[2] + " queue_drops=" + link.counters[3] + " to=" + link.to + "\n");
+    }
+    for (key in logger_energy) {
+        var energy = logger_energy[key];
+        log.log(time + " " + energy.id + " [INFO: Energest] " + energy.label + " mean: " + (energy.sum / energy.reports) + " over " + energy.reports + " reports\n");
+    }
+    logger_links = {};
+    logger_energy = {};
+}
+'''
+loggerMarker = re.compile(r'/\* RT logger: (\w+) ([\w,-]*) \*/')
+
+def configureLogger(script, mode):
+    '''
+    Sets a Cooja logger script up for a LoggerMode. "filter" drops, inside the simulation, the mote lines no record family reads
+    (Metrics.dispatcher plus LoggerFamilies), so Cooja writes and we parse only those. "aggregate" also adds up the Link Stats counters
+    and the Energest ratios of each node and logs them once, when the test ends: LinkStats sums the counters and Energy weights
+    each mean by its reports, so the metrics are the same as with the full log
+    '''
+    if mode == "all":
+        return script
+    if mode not in ("filter", "aggregate"):
+        raise ValueError("Unknown logger mode " + str(mode))
+    pattern = re.compile(r'log\.log\(\s*time \+ " " \+ id \+ " " \+ msg \+ "\\n"\s*\);')
+    if pattern.search(script) is None:
+        print("The logger script doesn't log the mote output as expected, logging all of it")
+        return script
+    families = dict(Metrics.dispatcher.recordFamilies, **LoggerFamilies)
+    rules = {}
+    for family, (recordType, prefix, contains) in families.items():
+        for p in (prefix if isinstance(prefix, tuple) else (prefix,)):
+            rules.setdefault(recordType or "*", []).append([p, contains])
+    script = pattern.sub("logger_record(time, id, msg);", script, count=1)
+    script = script.replace("log.testOK();", "logger_flush();\n        log.testOK();")
+    return ("/* RT logger: {} {} */\n".format(mode, ",".join(families)) +
+        "logger_rules = " + json.dumps(rules) + ";\n" +
+        "logger_aggregate = " + ("true" if mode == "aggregate" else "false") + ";\n" + LoggerScript + "\n" + script)
+
+def loggerConfig(script):
+    '''
+    Returns the (mode, families) a logger script was set up with by configureLogger, families being None when it logs everything
+    '''
+    res = loggerMarker.search(script or "")
+    if res is None:
+        return "all", None
+    return res.group(1), res.group(2).split(",")
+
+def sinkCount(simFile):
+    '''
+    APP_SINK_COUNT passed to the build commands of a parsed .csc (see Topology.py), 1 when they don't define it, as in node-rt.c
+    '''
+    for commands in simFile.getElementsByTagName('commands'):
+        res = re.search(r'\bAPP_SINK_COUNT=(\d+)', commands.firstChild.data if commands.firstChild else "")
+        if res:
+            return int(res.group(1))
+    return 1
+
+def getScheduler(makefile):
+    '''
+    RT_SCHEDULER built by a Makefile. The first assignment is the one make keeps, prepareWorkDir puts its choice above the default
+    '''
+    try:
+        with open(makefile) as f:
+            res = re.search(r'^RT_SCHEDULER\s*\??=\s*(\S+)', f.read(), re.M)
+    except OSError:
+        return None
+    return res.group(1) if res else None
+
+class Job(Base):
+    '''
+    A run waiting in or simulated by the JobQueue. Higher priority jobs start first, then the oldest.
+    state is one of queued, running, done, failed or cancelled; done jobs point to their Run
+    '''
+    __tablename__ = "jobs"
+    id = Column(Integer, primary_key=True)
+    experiment_id = Column(Integer, ForeignKey('experiments.id'), nullable=False)
+    experiment = relationship("Experiment")
+    defines = Column(PickleType)
+    convergence = Column(PickleType) # ConvergenceMonitor arguments, None runs to the TIMEOUT
+    priority = Column(Integer, nullable=False, default=0)
+    state = Column(String(20), nullable=False, default='queued', index=True)
+    created = Column(DateTime)
+    started = Column(DateTime)
+    finished = Column(DateTime)
+    message = Column(String(500))
+    run_id = Column(Integer, ForeignKey('runs.id'))
+    run = relationship("Run", foreign_keys=[run_id])
+    liveRun_id = Column(Integer, ForeignKey('runs.id')) # Run being filled by the LiveIngest while the job runs
+    liveRun = relationship("Run", foreign_keys=[liveRun_id])
+
+    def workDir(self):
+        return os.path.join(JobDir, str(self.id))
+
+    def logFile(self):
+        '''
+        Cooja log of the job, kept as JobDir/<id>.log once it finishes
+        '''
+        running = os.path.join(self.workDir(), "COOJA.log")
+        if self.state == 'running' or not os.path.exists(os.path.join(JobDir, "{}.log".format(self.id))):
+            return running
+        return os.path.join(JobDir, "{}.log".format(self.id))
+
+    def toDict(self):
+        return {'id': self.id, 'experiment': self.experiment_id, 'defines': self.defines, 'convergence': self.convergence, 'priority': self.priority, 'state': self.state,
+            'created': self.created, 'started': self.started, 'finished': self.finished, 'message': self.message, 'run': self.run_id}
+
+baselineRuns = Table('baseline_runs', meta,
+    Column('baseline_id', Integer, ForeignKey('baselines.id'), primary_key=True),
+    Column('run_id', Integer, ForeignKey('runs.id'), primary_key=True))
+
+class Baseline(Base):
+    '''
+    A tagged set of runs, the results of a Benchmark.py suite that later ones are compared against.
+    matrix is the suite that produced it and revision the git commit it was built from
+    '''
+    __tablename__ = "baselines"
+    id = Column(Integer, primary_key=True)
+    tag = Column(String(100), nullable=False, unique=True)
+    created = Column(DateTime)
+    revision = Column(String(50))
+    matrix = Column(PickleType)
+    runs = relationship("Run", secondary=baselineRuns, order_by="Run.id")
+
+    def getFrame(self):
+        '''
+        One row per run with the experiment, node count, parameters and summary metrics
+        '''
+        rows = []
+        for run in self.runs:
+            row = {'run': run.id, 'experiment': run.experiment.name if run.experiment else None, 'nodes': run.maxNodes - 1}
+            row.update(run.parameters or {})
+            row.update(run.getSummary())
+            rows.append(row)
+        return pd.DataFrame(rows)
+
+class Search(Base):
+    '''
+    A parameter search of Search.py: the space ({define: candidate values}), the objective (a Python expression over the summary
+    dict m, maximized) and the successive halving settings. Every simulation it asks for is one of its trials
+    '''
+    __tablename__ = "searches"
+    id = Column(Integer, primary_key=True)
+    name = Column(String(100), nullable=False, unique=True)
+    experiment_id = Column(Integer, ForeignKey('experiments.id'), nullable=False)
+    experiment = relationship("Experiment")
+    space = Column(PickleType)
+    candidates = Column(PickleType) # Configurations sampled from space, the ones of the first rung
+    objective = Column(String(500), nullable=False)
+    configurations = Column(Integer)
+    eta = Column(Integer)
+    repetitions = Column(Integer)
+    created = Column(DateTime)
+    finished = Column(DateTime)
+    trials = relationship("SearchTrial", back_populates="search", order_by="SearchTrial.id", cascade="all, delete-orphan")
+
+    def best(self, rung=None):
+        '''
+        The scored trials of the highest rung (or of rung), best first
+        '''
+        scored = [trial for trial in self.trials if trial.score is not None]
+        if not scored:
+            return []
+        rung = max(trial.rung for trial in scored) if rung is None else rung
+        return sorted((trial for trial in scored if trial.rung == rung), key=lambda trial: -trial.score)
+
+class SearchTrial(Base):
+    '''
+    One simulation of a search: a configuration at a rung, whose TIMEOUT (ms) grows with the rung, and the objective of its run
+    '''
+    __tablename__ = "search_trials"
+    id = Column(Integer, primary_key=True)
+    search_id = Column(Integer, ForeignKey('searches.id'), index=True, nullable=False)
+    search = relationship("Search", back_populates="trials")
+    rung = Column(Integer, nullable=False)
+    defines = Column(PickleType)
+    timeout = Column(Integer)
+    run_id = Column(Integer, ForeignKey('runs.id'))
+    run = relationship("Run")
+    score = Column(Float)
+    promoted = Column(Boolean, default=False)
+
+    def toDict(self):
+        return {'id': self.id, 'rung': self.rung, 'defines': self.defines, 'timeout': self.timeout, 'run': self.run_id, 'score': self.score, 'promoted': self.promoted}
+
 class ProjectConfFile(Base):
     '''
     Represents the project-conf.h file which is linked to experiment. Its used by bulkRun method
@@ -385,15 +1188,17 @@ class ProjectConfFile(Base):
     def __init__(self):
         defines = {}
     
-    def getFileContents(self):
+    def getFileContents(self, overrides=None):
         content = ""
-        for k, v in self.defines.items():
+        defines = dict(self.defines)
+        defines.update(overrides or {})
+        for k, v in defines.items():
             content += ("#define " + k + " " + str(v) + "\n")
         return content
     
-    def save(self, filename):
+    def save(self, filename, overrides=None):
         with open(filename, "w") as file:
-            file.write(self.getFileContents())
+            file.write(self.getFileContents(overrides))
 
 class Record(Base):
     '''
@@ -456,19 +1261,58 @@ class Metrics(Base):
 
 
     def __init__(self, run):
-        self.run = run
-        #print("Self lenght:" , len(self.run.records) )
-        self.application = Application(self)
-        #self.application.process()
-        #print("Processing MAC")
-        if run.parameters['MAKE_MAC'] ==  "MAKE_MAC_TSCH":
-            self.mac = MAC(self)
-        #print("Processing LinkStatus")
-        self.linkstats = LinkStats(self)
-        #print("Processing RPL")
-        self.rpl = RPL(self)
-        #print("Processing Energy")
-        self.energy = Energy(self)
+        # The caller adds the metrics and their layers to the session once they're built, until then the queries of the layers
+        # must not autoflush the pending Run.metric (SAWarning "not in session")
+        with db.no_autoflush:
+            self.run = run
+            self.initCache()
+            #print("Self lenght:" , len(self.run.records) )
+            self.application = Application(self)
+            #self.application.process()
+            #print("Processing MAC")
+            if run.parameters['MAKE_MAC'] ==  "MAKE_MAC_TSCH":
+                self.mac = MAC(self)
+            #print("Processing LinkStatus")
+            self.linkstats = LinkStats(self)
+            #print("Processing RPL")
+            self.rpl = RPL(self)
+            #print("Processing Energy")
+            self.energy = Energy(self)
+
+    @orm.reconstructor
+    def initCache(self):
+        self.families = None
+        self.layerResults = {}
+
+    def scan(self):
+        '''
+        Walks the run records once and keeps, for each registered family, the lines that belong to it
+        '''
+        if self.run.recordFile:
+            lines = readRecordFile(self.run.recordFile, Metrics.dispatcher.recordTypes())
+        else:
+            lines = (LogLine(*row) for row in db.query(Record.simTime, Record.node, Record.recordLevel, Record.recordType, Record.rawData).filter(Record.run_id == self.run.id).order_by(Record.id).yield_per(20000))
+        self.families = Metrics.dispatcher.dispatch(lines)
+
+    def getRecords(self, family) -> list:
+        if self.families is None:
+            self.scan()
+        return self.families[family]
+
+    def getColumns(self, source, family) -> dict:
+        '''
+        {column: numpy array} of a LogParser family (ex: 'tsch-sent'), in log order, tokenized by the C extension when it's built
+        from the lines of the record family source (ex: 'tsch-frames'), so the layers don't run a regex per record
+        '''
+        return self.cached(('columns', source), lambda: LogParser.tokenizeLines(self.getRecords(source)))[family]
+
+    def cached(self, key, compute):
+        '''
+        Returns the per-layer result stored under key, computing it on the first call
+        '''
+        if key not in self.layerResults:
+            self.layerResults[key] = compute()
+        return self.layerResults[key]
 
     def getSummary(self):
         '''
@@ -477,14 +1321,16 @@ class Metrics(Base):
         retorno = {}
         retorno['app-latency'] = self.application.latency.latencyMean()
         retorno['app-latency-median'] = self.application.latency.latencyMedian()
+        for q, value in self.application.latency.tailLatency().items():
+            retorno[LatencyDistribution.summaryKey(q)] = value
         retorno['app-pdr'] = self.application.pdr.getGlobalPDR()
         retorno['app-genPkg'] = len(self.application.records)
         retorno['rpl-parentsw'] = self.rpl.getParentSwitches()
-        #retorno['rpl-avgHops'] = self.rpl.getAverangeHops(slice=600000000)
-        #retorno['rpl-avgHopsSliced'] = self.rpl.getAverangeHops()
+        retorno['rpl-avgHops'] = self.rpl.getAverangeHops(slice=600000000)
+        retorno['rpl-avgHopsSliced'] = self.rpl.getAverangeHops()
         rplMessages = ['total','multicast-DIO','unicast-DIO','DIS','DAO','DAO-ACK']
+        rplType = self.rpl.getControlMessages()
         for typ in rplMessages:
-            rplType = self.rpl.getControlMessages()
             chave = str('rpl-msg-'+ typ)
             retorno.setdefault(chave,0)
             try:
@@ -496,6 +1342,7 @@ class Metrics(Base):
         retorno['mac-retransRate'] = retransmissions['retransRate']
         retorno['mac-disconnections'] = self.mac.getDisconnections()
         retorno['mac-formation'] = self.mac.formationTime()
+        retorno['mac-6p'] = self.mac.getSixtopOperations()
         #nbrQueue = self.mac.getNBRQueueOccupation()
         #retorno['mac-queuenbr-length'] = nbrQueue['length']
         #retorno['mac-queuenbr-occupation'] = nbrQueue['occupation']
@@ -509,8 +1356,118 @@ class Metrics(Base):
         retorno['energy-ChannelOccupation'] = self.energy.getChannelUtilization()
         return retorno
 
+class RunSummary(Base):
+    '''
+    Metrics.getSummary of a run, computed once at ingestion so exports read a single table instead of reparsing every run.
+    metricVersion is the METRIC_VERSION that computed it, rows from other versions are recomputed by Run.summarize
+    '''
+    __tablename__ = 'run_summary'
+    # Metrics.getSummary key: column
+    fields = {
+        'app-latency': 'appLatency',
+        'app-latency-median': 'appLatencyMedian',
+        'app-latency-p90': 'appLatencyP90',
+        'app-latency-p99': 'appLatencyP99',
+        'app-latency-p99.9': 'appLatencyP999',
+        'app-pdr': 'appPdr',
+        'app-genPkg': 'appGenPkg',
+        'rpl-parentsw': 'rplParentSw',
+        'rpl-avgHops': 'rplAvgHops',
+        'rpl-avgHopsSliced': 'rplAvgHopsSliced',
+        'rpl-msg-total': 'rplMsgTotal',
+        'rpl-msg-multicast-DIO': 'rplMsgMulticastDIO',
+        'rpl-msg-unicast-DIO': 'rplMsgUnicastDIO',
+        'rpl-msg-DIS': 'rplMsgDIS',
+        'rpl-msg-DAO': 'rplMsgDAO',
+        'rpl-msg-DAO-ACK': 'rplMsgDAOACK',
+        'mac-retransmissions': 'macRetransmissions',
+        'mac-retransRate': 'macRetransRate',
+        'mac-disconnections': 'macDisconnections',
+        'mac-formation': 'macFormation',
+        'mac-6p': 'mac6P',
+        'link-pdr': 'linkPdr',
+        'energy-RDC': 'energyRDC',
+        'energy-ChannelOccupation': 'energyChannelOccupation',
+    }
+    id = Column(Integer, primary_key=True)
+    run_id = Column(Integer, ForeignKey('runs.id'), index=True, unique=True)
+    run = relationship("Run", back_populates="summary")
+    metricVersion = Column(Integer, nullable=False)
+    appLatency = Column(Float)
+    appLatencyMedian = Column(Float)
+    appLatencyP90 = Column(Float)
+    appLatencyP99 = Column(Float)
+    appLatencyP999 = Column(Float)
+    appPdr = Column(Float)
+    appGenPkg = Column(Integer)
+    rplParentSw = Column(Integer)
+    rplAvgHops = Column(Float)
+    rplAvgHopsSliced = Column(Float)
+    rplMsgTotal = Column(Integer)
+    rplMsgMulticastDIO = Column(Integer)
+    rplMsgUnicastDIO = Column(Integer)
+    rplMsgDIS = Column(Integer)
+    rplMsgDAO = Column(Integer)
+    rplMsgDAOACK = Column(Integer)
+    macRetransmissions = Column(Integer)
+    macRetransRate = Column(Float)
+    macDisconnections = Column(Integer)
+    macFormation = Column(Float)
+    mac6P = Column(Integer)
+    linkPdr = Column(Float)
+    energyRDC = Column(Float)
+    energyChannelOccupation = Column(Float)
+
+    def __init__(self, run):
+        with db.no_autoflush: # As in Metrics, Run.summarize adds it
+            self.run = run
+            self.update()
+
+    def update(self):
+        summary = self.run.metric.getSummary()
+        for key, column in self.fields.items():
+            setattr(self, column, summary.get(key))
+        self.metricVersion = METRIC_VERSION
+
+    def toDict(self):
+        return {key: getattr(self, column) for key, column in self.fields.items()}
+
+class LatencyDistribution(Base):
+    '''
+    A LatencyHistogram of a run: all its packets (dimension 'all', key 0), those of a source node ('node'), of a hop depth when they
+    were generated ('hops') or generated in a LatencyWindow ('window', key is its start in s). Values are microseconds
+    '''
+    __tablename__ = 'latency_histograms'
+    id = Column(Integer, primary_key=True)
+    run_id = Column(Integer, ForeignKey('runs.id'), index=True, nullable=False)
+    run = relationship("Run", back_populates="latencyHistograms")
+    dimension = Column(String(20), nullable=False)
+    key = Column(Integer, nullable=False)
+    bits = Column(Integer, nullable=False)
+    counts = Column(PickleType) # {bucket index: packets}
+    total = Column(Integer)
+    valueSum = Column(Integer)
+    minimum = Column(Integer)
+    maximum = Column(Integer)
+
+    @staticmethod
+    def fromHistogram(dimension, key, histogram):
+        return LatencyDistribution(dimension=dimension, key=int(key), bits=histogram.bits, counts=histogram.counts, total=histogram.total,
+            valueSum=histogram.sum, minimum=histogram.minimum, maximum=histogram.maximum)
+
+    def toHistogram(self):
+        return LatencyHistogram(self.bits, self.counts, self.total, self.valueSum, self.minimum, self.maximum)
+
+    @staticmethod
+    def summaryKey(q):
+        return 'app-latency-p{:g}'.format(q)
+
+appGeneratePattern = re.compile(r'app generate packet seqnum=(\d+) node_id=(\d+)')
+appReceivePattern = re.compile(r'app receive packet seqnum=(\d+) from=(\S+)')
+
 class Application(Base):
     __tablename__ = 'application'
+    recordFamilies = {'app': ('App', 'app ', None)}
     id = Column(Integer, primary_key=True)
     metric_id = Column(Integer, ForeignKey('metrics.id')) # The ForeignKey must be the physical ID, not the Object.id
     metric = relationship("Metrics", back_populates="application")
@@ -527,34 +1484,40 @@ class Application(Base):
         self.pdr = PDR(self)
 
     def process(self):
+        '''
+        Correlates the generated and received application packets by (source node, seqnum) and bulk inserts the AppRecords
+        '''
         print("Processing App")
-        data = self.metric.run.records
-        for rec in data:
-            if rec.rawData.startswith("app generate"):
-                sequence = int(rec.rawData.split()[3].split("=")[1])
-                node = int(rec.rawData.split()[4].split("=")[1])
-                genTime = int(rec.simTime)
-                dstNode = 1 #That simulation doesn't define a customized sink
-                #print("Node: " ,  node , "Seq: " , sequence , "Generation Time: ", genTime ,"Destination" , dstNode)
-                newLatRec = AppRecord(genTime,node,dstNode,sequence)
-                newLatRec.rcv = False
-                db.add(newLatRec)
-                self.records.append(newLatRec)
+        if self.id is None:
+            db.add(self)
+            db.flush()
+        rows = []
+        generated = {}
+        for rec in self.metric.getRecords('app'):
+            res = appGeneratePattern.match(rec.rawData)
+            if res:
+                # The sink is only known on reception, there can be several of them (APP_SINK_COUNT)
+                row = {'genTime': int(rec.simTime), 'rcvTime': None, 'rcv': False, 'srcNode': int(res.group(2)), 'dstNode': 1, 'sqnNumb': int(res.group(1)), 'application_id': self.id}
+                rows.append(row)
+                generated.setdefault((row['srcNode'], row['sqnNumb']), row)
                 continue
-            
-            if rec.rawData.startswith("app receive"):
-                sequence = int(rec.rawData.split()[3].split("=")[1])
-                recTime = int(rec.simTime)
-                srcNode = int(rec.rawData.split()[4].split("=")[1].split(":")[5], 16) # Converts Hex to Dec
-                for record in self.records:
-                    if (record.srcNode == srcNode and record.sqnNumb == sequence):
-                        record.rcvPkg(recTime)
-                        record.rcv = True
-                #print("Node: " ,  srcNode  , "Seq: " , sequence , "Receive Time: ", recTime)
-                        break
+            res = appReceivePattern.match(rec.rawData)
+            if res:
+                srcNode = int(res.group(2).rsplit(":", 1)[-1], 16) # Converts Hex to Dec
+                row = generated.get((srcNode, int(res.group(1))))
+                if row is not None:
+                    row['rcvTime'] = int(rec.simTime)
+                    row['rcv'] = True
+                    row['dstNode'] = int(rec.node)
+        if rows:
+            db.connection().execute(AppRecord.__table__.insert(), rows)
+        db.expire(self, ['records'])
         db.commit()
         print("Done")
 
+# Root's "links: <child> to <parent>" lines
+linksPattern = re.compile(r'links: +([0-9A-Fa-f:]+) +to +([0-9A-Fa-f:]+)')
+
 class RPL(Base):
     '''
     RPL Metrics Class
@@ -562,15 +1525,24 @@ class RPL(Base):
     __tablename__ = 'rpl'
     id = Column(Integer, primary_key=True)
     metric = relationship("Metrics", uselist=False, back_populates="rpl")
+    recordFamilies = {
+        'rpl-parent-switch': ('RPL', None, 'parent switch:'),
+        'rpl-messages': ('RPL', None, 'sending a '),
+        'rpl-links': ('RPL', 'links: ', None),
+        'rpl-state': ('RPL', None, 'state: '),
+    }
 
     def __init__(self,metric):
         self.metric = metric
     
     def processParentSwitches(self) -> dict:
+        return self.metric.cached('rpl-parent-switch', self.computeParentSwitches)
+
+    def computeParentSwitches(self) -> dict:
         results = {}
         for i in range(1,(self.metric.run.maxNodes)):
             results[str(i)] = []
-        data = [rec for rec in self.metric.run.records if rec.recordType == "RPL" and "parent switch:" in rec.rawData]
+        data = self.metric.getRecords('rpl-parent-switch')
         reExp = re.compile('\((.*?)\)')
         for sw in data:
             old = ':'.join(map(str, sw.rawData.split('->')[0].split(":")[1:])).strip()
@@ -593,7 +1565,10 @@ class RPL(Base):
         '''
         Return the total amount of RPL messages and the sum of each message type
         '''
-        records = [rec for rec in self.metric.run.records if rec.recordType == "RPL" and "sending a " in rec.rawData]
+        return self.metric.cached('rpl-messages', self.computeControlMessages)
+
+    def computeControlMessages(self) -> dict:
+        records = self.metric.getRecords('rpl-messages')
         retorno = {'total':len(records)}
         for r in records:
             msgType = r.rawData.split(' ')[2]
@@ -607,58 +1582,112 @@ class RPL(Base):
 
         parameters: slice - The time interval for each measured slice
         '''
-        isItIpv6 = '((?:(?:[0-9A-Fa-f]{1,4}:){6}(?:[0-9A-Fa-f]{1,4}:[0-9A-Fa-f]{1,4}|(?:(?:[0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5])\\.){3}(?:[0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5]))|::(?:[0-9A-Fa-f]{1,4}:){5}(?:[0-9A-Fa-f]{1,4}:[0-9A-Fa-f]{1,4}|(?:(?:[0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5])\\.){3}(?:[0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5]))|(?:[0-9A-Fa-f]{1,4})?::(?:[0-9A-Fa-f]{1,4}:){4}(?:[0-9A-Fa-f]{1,4}:[0-9A-Fa-f]{1,4}|(?:(?:[0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5])\\.){3}(?:[0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5]))|(?:[0-9A-Fa-f]{1,4}:[0-9A-Fa-f]{1,4})?::(?:[0-9A-Fa-f]{1,4}:){3}(?:[0-9A-Fa-f]{1,4}:[0-9A-Fa-f]{1,4}|(?:(?:[0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5])\\.){3}(?:[0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5]))|(?:(?:[0-9A-Fa-f]{1,4}:){,2}[0-9A-Fa-f]{1,4})?::(?:[0-9A-Fa-f]{1,4}:){2}(?:[0-9A-Fa-f]{1,4}:[0-9A-Fa-f]{1,4}|(?:(?:[0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5])\\.){3}(?:[0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5]))|(?:(?:[0-9A-Fa-f]{1,4}:){,3}[0-9A-Fa-f]{1,4})?::[0-9A-Fa-f]{1,4}:(?:[0-9A-Fa-f]{1,4}:[0-9A-Fa-f]{1,4}|(?:(?:[0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5])\\.){3}(?:[0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5]))|(?:(?:[0-9A-Fa-f]{1,4}:){,4}[0-9A-Fa-f]{1,4})?::(?:[0-9A-Fa-f]{1,4}:[0-9A-Fa-f]{1,4}|(?:(?:[0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5])\\.){3}(?:[0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5]))|(?:(?:[0-9A-Fa-f]{1,4}:){,5}[0-9A-Fa-f]{1,4})?::[0-9A-Fa-f]{1,4}|(?:(?:[0-9A-Fa-f]{1,4}:){,6}[0-9A-Fa-f]{1,4})?::))'
+        series = self.getHopsTimeSeries(slice)
+        if not series:
+            return 0
+        return statistics.mean([s['averange'] for s in series])
+
+    def getHopsTimeSeries(self, slice = 300000000) -> list:
+        '''
+        Return, for each time slice, the averange hops and the hop depth of each node ({'time', 'averange', 'nodes'})
+
+        parameters: slice - The time interval for each measured slice
+        '''
+        return self.metric.cached(('rpl-hops', slice), lambda: self.computeHops(slice))
+
+    def computeHops(self, slice) -> list:
+        '''
+        Single time-ordered sweep over the root "links:" lines, the parent map is updated incrementally and the chain lengths are memoized per slice
+        '''
+        records = self.metric.getRecords('rpl-links')
         parents = {}
+        index = 0
         time = slice
         anterior = 0
         endtime = self.metric.run.experiment.getTimeout() * 1000 #getTimeout is in ms * for us
         retorno = []
         while time < endtime:
-            records = [rec for rec in self.metric.run.records if rec.recordType == "RPL" and "links" in rec.rawData and rec.simTime > anterior and rec.simTime < time]
-            anterior = time
-            time += slice
-            for rec in records:
-                if rec.recordType == "RPL" and rec.rawData.startswith("links: "):
-                    res = re.findall(isItIpv6,rec.rawData)
-                    if len(res) == 2:
-                        child = int(res[0].split(":")[-1],16)
-                        parent = int(res[1].split(":")[-1],16)
-                        if not child in parents:
-                            parents[child] = {}
-                        if not parent in parents:
-                            parents[parent] = None
-                        parents[child] = parent
-            data = []
-            for node in range(2,(self.metric.run.maxNodes)): #Starting from 2nd node
-                hops = 0
-                try: 
-                    while(parents[node] != None):
-                        node = parents[node]
-                        hops += 1
-                        if hops > 50:
-                            continue
-                    data.append(hops)
-                except:
+            while index < len(records) and records[index].simTime < time:
+                rec = records[index]
+                index += 1
+                if rec.simTime <= anterior:
                     continue
+                res = linksPattern.match(rec.rawData)
+                if res:
+                    child = int(res.group(1).split(":")[-1],16)
+                    parent = int(res.group(2).split(":")[-1],16)
+                    parents[child] = parent
+                    parents.setdefault(parent, None)
+            depth = {}
+            nodes = {}
+            for node in self.metric.run.senders:
+                hops = self.chainLength(node, parents, depth)
+                if hops is not None:
+                    nodes[node] = hops
             try:
-                retorno.append(statistics.mean(data))
+                averange = statistics.mean(nodes.values())
             except statistics.StatisticsError:
-                retorno.append(0)
-        return statistics.mean(retorno)
+                averange = 0
+            retorno.append({'time': time, 'averange': averange, 'nodes': nodes})
+            anterior = time
+            time += slice
+        return retorno
+
+    def getDepths(self, times, nodes):
+        '''
+        Hops of nodes[i] to a root at times[i] (sorted), by the parent map of the root "links:" lines logged until then. None when unknown
+        '''
+        records = self.metric.getRecords('rpl-links')
+        parents = {}
+        depth = {}
+        index = 0
+        retorno = []
+        for time, node in zip(times, nodes):
+            while index < len(records) and records[index].simTime <= time:
+                res = linksPattern.match(records[index].rawData)
+                index += 1
+                if res:
+                    child = int(res.group(1).split(":")[-1],16)
+                    parent = int(res.group(2).split(":")[-1],16)
+                    if parents.get(child) != parent:
+                        parents[child] = parent
+                        parents.setdefault(parent, None)
+                        depth = {}
+            retorno.append(self.chainLength(node, parents, depth))
+        return retorno
+
+    def chainLength(self, node, parents, depth):
+        '''
+        Hops from node to the root following parents, None when the chain is broken or has a loop. Results are stored in depth
+        '''
+        chain = []
+        while node not in depth:
+            if node not in parents or node in chain:
+                depth[node] = None
+                break
+            if parents[node] is None:
+                depth[node] = 0
+                break
+            chain.append(node)
+            node = parents[node]
+        hops = depth[node]
+        for n in reversed(chain):
+            hops = None if hops is None else hops + 1
+            depth[n] = hops
+        return hops
 
     def getMetrics(self):
         '''
         Returns the RPL metrics (Trickle Timer and Rank)
         '''
+        return self.metric.cached('rpl-state', self.computeMetrics)
+
+    def computeMetrics(self):
         retorno = []
-        data = [rec for rec in self.metric.run.records if rec.recordType == "RPL"]
-        for rec in data:
-            res = re.compile('.*?state: (\w*),.*? rank (\d*).*?dioint (\d*).*?nbr count (\d*)').match(rec.rawData)
-            if (res):
-                rank = int(res.group(2))
-                trickle = (2**int(res.group(3)))/(60*1000.)
-                nbrCount = int(res.group(4))
-                retorno.append({'node': rec.node, 'rank': rank, 'trickle': trickle, "state":res.group(1)})
+        data = self.metric.getColumns('rpl-state', 'rpl-state')
+        for node, rank, dioint, state in zip(*(data[column].tolist() for column in ('node', 'rank', 'dioint', 'state'))):
+            trickle = (2**dioint)/(60*1000.)
+            retorno.append({'node': node, 'rank': rank, 'trickle': trickle, "state": LogParser.RPL_STATES[state] if state >= 0 else None})
         return retorno
 
     def printMetrics(self):
@@ -690,13 +1719,13 @@ class RPL(Base):
         data = {}
         results = self.processParentSwitches()
         from collections import Counter
-        index = 2
+        index = self.metric.run.senders.start
         import io
         import base64
         import matplotlib.pyplot as plt
         plt.clf()
         for k in results:
-            if k == "0" or k == "1":
+            if int(k) < index: # The sinks are roots
                 continue
             swCount = len(results[k])
             data[index] = swCount
@@ -741,7 +1770,7 @@ class RPL(Base):
                 continue
             nodeOrigin = str('N' + i)
             try:
-                nodeParent = data[i].pop()['new'] # Get the last change
+                nodeParent = data[i][-1]['new'] # Get the last change
             except IndexError:
                 continue
             if nodeParent == None:
@@ -830,6 +1859,71 @@ class MACMessage(Base):
     def __str__(self) -> str:
         return "{self.origin}<->{self.dest} Q:{self.enQueued} S({self.isSent}):{self.sentTime} S({self.isReceived}):{self.rcvTime} Sq:{self.seqno}".format(self=self)
 
+class FrameCorrelator:
+    '''
+    Builds the MACMessage of every TSCH frame (enqueue, send, receive, tries and status) in a single pass over the tsch-send,
+    tsch-sent and tsch-received columns of LogParser. Frames are matched by (origin, seqno) with no time limit, however long they wait
+    in the queue: the seqno is a per node 8-bit counter and the queue holds far fewer frames, so when a node enqueues a seqno again
+    the previous frame with it is gone (sent, received or dropped) and whatever is still pending for it is forgotten.
+    '''
+    def __init__(self, results):
+        self.results = results
+        self.queued = {}   # (origin, seqno) -> frame waiting for its "packet sent" line
+        self.sent = {}     # (origin, seqno) -> sent frame waiting for its "received from" line
+        self.early = {}    # (origin, seqno) -> (receiver, time) of a reception logged before the "packet sent" line
+
+    def correlate(self, send, sent, received):
+        '''
+        Feeds the three families in time order. Lines of the same time go enqueues first, then receptions, then "packet sent"
+        '''
+        families = [(send, self.enqueue, ('dest', 'seqno', 'queue', 'queueSize', 'queueAll', 'queueAllSize', 'len', 'dataLen')),
+                    (received, self.receive, ('src', 'seqno')),
+                    (sent, self.transmit, ('dest', 'seqno', 'status', 'tx'))]
+        rows = [list(zip(*(family[column].tolist() for column in ('time', 'node') + columns))) for family, handler, columns in families]
+        times = np.concatenate([family['time'] for family, handler, columns in families])
+        kinds = np.repeat(np.arange(len(families)), [len(r) for r in rows])
+        indexes = np.concatenate([np.arange(len(r)) for r in rows])
+        order = np.lexsort((kinds, times)) # Stable, the lines of a family keep their log order
+        for kind, index in zip(kinds[order].tolist(), indexes[order].tolist()):
+            families[kind][1](*rows[kind][index])
+
+    def enqueue(self, time, origin, dest, seqno, *values):
+        macMsg = MACMessage(origin, dest, float(time), seqno, *values)
+        self.results.setdefault(str(origin), []).append(macMsg)
+        if macMsg.dest == 0 or macMsg.dest == 65535:
+            #Broadcast message is sent by all, I cant control who receives.
+            macMsg.isReceived = True
+            macMsg.isSent = True
+            macMsg.tries = 1
+            return
+        # The seqno is reused, the frame that had it was never sent or never received
+        key = (origin, seqno)
+        self.sent.pop(key, None)
+        self.early.pop(key, None)
+        self.queued[key] = macMsg
+
+    def transmit(self, time, origin, dest, seqno, status, tx):
+        key = (origin, seqno)
+        msg = self.queued.pop(key, None)
+        if msg is None:
+            return
+        msg.sent(float(time), status, tx)
+        early = self.early.pop(key, None)
+        if early is not None and early[0] == msg.dest:
+            msg.receive(early[1])
+        else:
+            self.sent[key] = msg
+
+    def receive(self, time, receiver, src, seqno):
+        key = (src, seqno)
+        msg = self.sent.get(key)
+        if msg is not None and msg.dest == receiver:
+            del self.sent[key]
+            msg.receive(float(time))
+        elif key in self.queued:
+            # The receiver logged it before the sender got the ACK, duplicates of a retransmission keep the first time
+            self.early.setdefault(key, (receiver, float(time)))
+
 class MAC(Base):
     '''
     Represents the MAC Layer
@@ -839,6 +1933,12 @@ class MAC(Base):
     id = Column(Integer, primary_key=True)
     metric = relationship("Metrics", uselist=False, back_populates="mac")
     results = Column(PickleType)
+    recordFamilies = {
+        'tsch-frames': ('TSCH', ("send packet to", "packet sent to", "received from"), None),
+        'tsch-ingress': ('TSCH', ("leaving the network", "association done"), None),
+        'csma': ('CSMA', None, None),
+        'sixtop': ('6top', 'RippleTrickle - sf-simple: ', None),
+    }
 
     def __init__(self,metric):
         self.metric = metric
@@ -852,69 +1952,16 @@ class MAC(Base):
         results['65535'] = []
 
         if self.metric.run.parameters['MAKE_MAC'].split('_')[-1] == "TSCH":
-            data = [rec for rec in self.metric.run.records if rec.recordType == "TSCH"]
-            for rec in data:
-                if rec.rawData.startswith("send packet to"):
-                    origin = int(rec.node)
-                    dest = int(rec.rawData.split()[3].split('.')[0], 16)
-                    enQueued = float(rec.simTime)
-                    seqnum = int(rec.rawData.split()[6].replace(',',''))
-                    queueNBROccupied = int(rec.rawData.split()[8].split('/')[0])
-                    queueNBRSize = int(rec.rawData.split()[8].split('/')[1])
-                    queueGlobalOccupied = int(rec.rawData.split()[9].replace(',','').split('/')[0])
-                    queueGlobalSize = int(rec.rawData.split()[9].replace(',','').split('/')[1])
-                    headerLen = int(rec.rawData.split()[11])
-                    dataLen = int(rec.rawData.split()[12])
-                    macMsg = MACMessage(origin, dest, enQueued, seqnum, queueNBROccupied, queueNBRSize, queueGlobalOccupied, queueGlobalSize, headerLen, dataLen)
-                    if macMsg.dest == 0 or macMsg.dest == 65535:
-                        macMsg.isReceived = True
-                        macMsg.isSent = True
-                        macMsg.tries = 1
-                    results[str(origin)].append(macMsg)
-                    continue
-                if rec.rawData.startswith("packet sent to"):
-                    dest = int(rec.rawData.split()[3].split('.')[0], 16)
-                    seqnum = int(rec.rawData.split()[5].replace(',',''))
-                    sentTime = float(rec.simTime)
-                    status = int(rec.rawData.split()[7].replace(',',''))
-                    tx = int(rec.rawData.split()[9].replace(',',''))
-                    for msg in reversed(results[str(rec.node)]):
-                        if msg.isSent:
-                            continue
-                        if ( msg.seqno == seqnum): #and msg.dest == dest):
-                            time = sentTime - msg.enQueued 
-                            if (time > 10000000):
-                                continue
-                            else:
-                                msg.sent(sentTime, status, tx)
-                                if macMsg.dest == 0 or macMsg.dest == 65535:
-                                    #Broadcast message is sent by all, I cant control who receives."
-                                    # TODO: Figure out why the seqno changes
-                                    msg.receive(sentTime)
-                                    msg.tries = 1
-                                continue
-            for rec in data:
-                if rec.rawData.startswith("received from"): 
-                    dest = int(rec.node)
-                    origin = int(rec.rawData.split()[2].split('.')[0], 16)
-                    seqnum = int(rec.rawData.split()[5])
-                    rcvTime = float(rec.simTime)
-                    for msg in results[str(origin)]:
-                        if msg.isReceived:
-                            continue
-                        if msg.seqno == seqnum and msg.dest == dest and msg.isSent and not msg.isReceived:
-                            time = rcvTime - msg.sentTime
-                            if time < 10000000:
-                                msg.receive(rcvTime)
-                                break
-                            else:
-                                None
+            FrameCorrelator(results).correlate(*(self.metric.getColumns('tsch-frames', family) for family in ('tsch-send', 'tsch-sent', 'tsch-received')))
         else:
-            data = [rec for rec in self.metric.run.records if rec.recordType == "CSMA"]
+            data = self.metric.getRecords('csma')
         self.results =  results
         
     def processIngress(self):
-        data = [rec for rec in self.metric.run.records if rec.recordType == "TSCH"]
+        return self.metric.cached('tsch-ingress', self.computeIngress)
+
+    def computeIngress(self):
+        data = self.metric.getRecords('tsch-ingress')
         results = [[] for x in range(self.metric.run.maxNodes)]
         for rec in data:
             if rec.rawData.startswith("leaving the network"):
@@ -930,9 +1977,9 @@ class MAC(Base):
         Returns the network formation time (ms)
         In case of never had connected, raises an Exception
         '''
-        data = [rec for rec in self.metric.run.records if rec.recordType == "TSCH"]
+        data = self.metric.getRecords('tsch-ingress')
         simNodes = self.metric.run.maxNodes - 1
-        connected = 1
+        connected = self.metric.run.sinks or 1 # The sinks are coordinators, they don't associate
         for rec in data:
             if rec.rawData.startswith("leaving the network"):
                 connected -= 1
@@ -951,9 +1998,9 @@ class MAC(Base):
         import base64
         tempBuffer = io.BytesIO()
         plt.clf()
-        index = 2
+        index = self.metric.run.senders.start
         results = self.processIngress()
-        for i in results[2:]:
+        for i in results[index:]:
             started = 0
             x = [0,0]
             for j in i:
@@ -973,7 +2020,7 @@ class MAC(Base):
         plt.axvline(x=int(self.metric.run.parameters['APP_WARM_UP_PERIOD_SEC']), label="Warm-up Time", ls=':', c='Orange')
         plt.xlabel("Simulation Time (S)")
         plt.ylabel("Nodes")
-        plt.yticks(range(2,self.metric.run.maxNodes))
+        plt.yticks(self.metric.run.senders)
         plt.title("Node Ingress (TSCH)")
         plt.savefig(tempBuffer, format = 'png')
         return base64.b64encode(tempBuffer.getvalue()).decode()
@@ -1057,6 +2104,12 @@ class MAC(Base):
         plt.savefig(tempBuffer, format = 'png')
         return base64.b64encode(tempBuffer.getvalue()).decode()
 
+    def getSixtopOperations(self):
+        '''
+        Cells added or removed by 6P transactions of the scheduling function, counted on both peers. Always 0 for Orchestra and minimal
+        '''
+        return len(self.metric.getRecords('sixtop'))
+
     def getDisconnections(self):
         '''
         Get the amount of disconnections from TSCH
@@ -1142,22 +2195,20 @@ class LinkStats(Base):
     __tablename__ = 'linkstats'
     id = Column(Integer, primary_key=True)
     metric = relationship("Metrics", uselist=False, back_populates="linkstats")
+    recordFamilies = {'linkstats': ('Link Stats', None, None)}
 
     
     def __init__(self,metric):
         self.metric = metric
 
     def getNodesPDR(self) -> dict:
-        nodesStats = {}
-        for n in range(self.metric.run.maxNodes):
-            nodesStats[n] = {"tx": 0, "ack":0}
-        data = [rec for rec in self.metric.run.records if rec.recordType == "Link Stats"]
-        for rec in data:
-            tx = int(rec.rawData.split()[2].split("=")[1])
-            ack = int(rec.rawData.split()[3].split("=")[1])
-            nodesStats[rec.node]['tx'] = nodesStats[rec.node]['tx'] + tx
-            nodesStats[rec.node]['ack'] = nodesStats[rec.node]['ack'] + ack
-        return nodesStats
+        return self.metric.cached('linkstats', self.computeNodesPDR)
+
+    def computeNodesPDR(self) -> dict:
+        data = self.metric.getColumns('linkstats', 'linkstats')
+        tx = np.bincount(data['node'], weights=data['tx'], minlength=self.metric.run.maxNodes)
+        ack = np.bincount(data['node'], weights=data['ack'], minlength=self.metric.run.maxNodes)
+        return {n: {"tx": int(tx[n]), "ack": int(ack[n])} for n in range(self.metric.run.maxNodes)}
 
     def getPDR(self):
         nodesStats = self.getNodesPDR()
@@ -1180,7 +2231,7 @@ class LinkStats(Base):
         tempBuffer = io.BytesIO()
         plt.clf()
         data = {}
-        index = 2
+        index = self.metric.run.senders.start
         for i,j in self.getNodesPDR().items():
             if i < index:
                 continue
@@ -1240,14 +2291,14 @@ class PDR(Base):
         data = {}
         results = self.processResults()
         from collections import Counter
-        index = 2
+        index = self.application.metric.run.senders.start
         totalGlobal = 0
         trueGlobal = 0
         import io
         import base64
         import matplotlib.pyplot as plt
         plt.clf()
-        for i in results[2:]: # The first is the sink node
+        for i in results[index:]: # The first are the sink nodes
             node = Counter(i)
             total = node[True] + node[False]
             totalGlobal += total
@@ -1314,9 +2365,45 @@ class Latency(Base):
         globalMedian = round(median(values),3)
         return globalMedian
 
+    def latencyPercentile(self, q):
+        value = self.getHistograms().get(('all', 0), LatencyHistogram()).quantile(q)
+        return round(value / 1000, 3) if value is not None else None
+
+    def tailLatency(self, quantiles=LatencyQuantiles):
+        '''
+        {q: latency (ms)} of all the received packets at each of the quantiles
+        '''
+        return {q: self.latencyPercentile(q) for q in quantiles}
+
+    def getHistograms(self):
+        '''
+        {(dimension, key): LatencyHistogram} of the received packets, see LatencyDistribution for the dimensions.
+        Packets whose source had no route to a root in the "links:" lines logged before them are left out of 'hops'
+        '''
+        return self.application.metric.cached('latency-histograms', self.computeHistograms)
+
+    def computeHistograms(self):
+        import numpy as np
+        rows = db.query(AppRecord.srcNode, AppRecord.genTime, AppRecord.rcvTime).filter(AppRecord.application_id == self.application.id,
+            AppRecord.rcv == True).order_by(AppRecord.genTime).all()
+        if not rows:
+            return {}
+        src, genTime, rcvTime = np.array(rows, dtype=np.int64).T
+        latency = rcvTime - genTime
+        window = LatencyWindow * 1000000
+        histograms = {('all', 0): LatencyHistogram.of(latency)}
+        for dimension, keys in (('node', src), ('window', genTime // window * LatencyWindow)):
+            for key, histogram in LatencyHistogram.byKey(keys, latency).items():
+                histograms[(dimension, key)] = histogram
+        depths = np.array([-1 if d is None else d for d in self.application.metric.rpl.getDepths(genTime.tolist(), src.tolist())], dtype=np.int64)
+        known = depths >= 0
+        for key, histogram in LatencyHistogram.byKey(depths[known], latency[known]).items():
+            histograms[('hops', key)] = histogram
+        return histograms
+
     def getLatencyDataByNode(self):
         myData = {}
-        for i in range(2,(self.application.metric.run.maxNodes)):
+        for i in self.application.metric.run.senders:
             myData['N' + str(i)] = []
         for rec in self.application.records:
             if rec.rcv:
@@ -1324,9 +2411,11 @@ class Latency(Base):
         return myData
 
     def getLatencyMedianByNode(self):
+        histograms = self.getHistograms()
         retorno = {}
-        for k,v in self.application.latency.getLatencyDataByNode().items():
-            retorno[k] = median(v)
+        for i in self.application.metric.run.senders:
+            histogram = histograms.get(('node', i))
+            retorno['N' + str(i)] = round(histogram.quantile(50) / 1000, 3) if histogram is not None else None
         return retorno
 
     def printLatencyByNode(self):
@@ -1407,7 +2496,7 @@ class Latency(Base):
         plt.clf()
         tempBuffer = io.BytesIO()
         nodes = self.getNodes()
-        for i in range(2,self.application.metric.run.maxNodes):
+        for i in self.application.metric.run.senders:
             x = [a[0]/1000 for a in nodes[i]] # Seconds
             y = [round(a[1],3) for a in nodes[i]] # Miliseconds
             plt.plot(x, y,linestyle="",marker=".", label = "Node "+str(i))
@@ -1452,6 +2541,10 @@ class AppRecord(Base):
     def getLatency(self):
         return self.rcvTime - self.genTime
 
+energestMeanPattern = re.compile(r'(Radio Tx|Radio total) mean: (\S+) over (\d+) reports')
+energestTxPattern = re.compile(r'Radio Tx\s*:\s*(\d*)/\s*(\d+)')
+energestTotalPattern = re.compile(r'Radio total\s*:\s*(\d*)/\s*(\d+)')
+
 class Energy(Base):
     '''
     Energy-related Metrics
@@ -1460,6 +2553,10 @@ class Energy(Base):
     id = Column(Integer, primary_key=True)
     metric = relationship("Metrics", uselist=False, back_populates="energy")
     results = Column(MutableList.as_mutable(PickleType))
+    recordFamilies = {
+        'energest': ('Energest', None, None),
+        'energest-mean': ('Energest', None, ' mean: '),
+    }
 
     def __init__(self,metric):
         self.metric = metric
@@ -1471,7 +2568,7 @@ class Energy(Base):
             The Energest module reports a period each 60 seconds 
             :return: float
         '''
-        return pd.DataFrame(self.results).set_index('time')['channel-utilization'].mean()
+        return self.meanOfPeriods('channel-utilization')
     
     def getRadioDutyCicle(self):
         '''
@@ -1479,18 +2576,32 @@ class Energy(Base):
             :return: float
         '''
 
-        return pd.DataFrame(self.results).set_index('time')['duty-cycle'].mean()
+        return self.meanOfPeriods('duty-cycle')
+
+    def meanOfPeriods(self, column):
+        '''
+        Mean over all the Energest periods. Lines of an aggregating logger (configureLogger) are already a mean of several periods
+        '''
+        results = pd.DataFrame(self.results).set_index('time')
+        if 'reports' not in results:
+            return results[column].mean()
+        results = results[results[column].notna()]
+        reports = results['reports'].fillna(1)
+        return (results[column] * reports).sum() / reports.sum()
 
     def parseEnergest(self, log):
         '''
         method extracted from: https://github.com/contiki-ng/contiki-ng/blob/develop/examples/benchmarks/rpl-req-resp/parse.py
         '''
-        res = re.compile('Radio Tx\s*:\s*(\d*)/\s*(\d+)').match(log)
+        res = energestMeanPattern.match(log)
+        if res:
+            return {'channel-utilization' if res.group(1) == 'Radio Tx' else 'duty-cycle': float(res.group(2)), 'reports': int(res.group(3))}
+        res = energestTxPattern.match(log)
         if res:
             tx = float(res.group(1))
             total = float(res.group(2))
             return {'channel-utilization': 100.*tx/total }
-        res = re.compile('Radio total\s*:\s*(\d*)/\s*(\d+)').match(log)
+        res = energestTotalPattern.match(log)
         if res:
             radio = float(res.group(1))
             total = float(res.group(2))
@@ -1500,15 +2611,166 @@ class Energy(Base):
 
     #@orm.reconstructor
     def processEnergy(self):
-        records = [rec for rec in self.metric.run.records if rec.recordType == "Energest"]
-        for rec in records:
-            #if rec.recordType == "Energest": # No need because
+        '''
+        The Radio Tx and Radio total periods come from the energest columns, only the means of an aggregating logger are parsed here
+        '''
+        periods = self.metric.getColumns('energest', 'energest')
+        columns = {LogParser.ENERGEST_LABELS.index('Radio Tx'): 'channel-utilization', LogParser.ENERGEST_LABELS.index('Radio total'): 'duty-cycle'}
+        for time, kind, value, total in zip(*(periods[column].tolist() for column in ('time', 'kind', 'value', 'total'))):
+            if kind in columns and total > 0:
+                self.results.append({columns[kind]: 100.*value/total, 'time': time})
+        for rec in self.metric.getRecords('energest-mean'):
             parsing = self.parseEnergest(rec.rawData)
             if parsing != None:
                 parsing['time'] = rec.simTime
-                self.results.append(parsing)    
+                self.results.append(parsing)
+        self.results.sort(key=lambda result: result['time'])
 
 Experiment.runs = relationship("Run", order_by = Run.id, back_populates="experiment")
+Metrics.dispatcher = RecordDispatcher([Application, MAC, RPL, LinkStats, Energy])
 Run.records = relationship("Record", order_by = Record.id, back_populates="run")
 #Application.records = relationship("AppRecord", order_by = AppRecord.id, back_populates="application")
 meta.create_all(engine)
+
+def upgradeSchema():
+    '''
+    create_all doesn't alter existing tables, so add the columns introduced after the database was created
+    '''
+    from sqlalchemy import text
+    inspector = inspect(engine)
+    tables = inspector.get_table_names()
+    with engine.begin() as connection:
+        for table in meta.sorted_tables:
+            if table.name not in tables:
+                continue
+            existing = [c['name'] for c in inspector.get_columns(table.name)]
+            for column in table.columns:
+                if column.name not in existing:
+                    connection.execute(text("ALTER TABLE {} ADD COLUMN {} {}".format(table.name, column.name, column.type.compile(engine.dialect))))
+
+upgradeSchema()
+
+def backfillParameters():
+    '''
+    Fills run_parameters for the runs stored before it existed
+    '''
+    runs = db.query(Run).filter(Run.parameters != None, ~Run.parameterValues.any()).all()
+    for run in runs:
+        run.setParameters(run.parameters)
+    if runs:
+        db.commit()
+        print("Indexed the parameters of {} runs".format(len(runs)))
+
+backfillParameters()
+
+def refreshReplica():
+    '''
+    Copies DBName to the read replica with SQLite's online backup, readers of the main database aren't blocked meanwhile
+    '''
+    if replicaEngine is None:
+        return False
+    source = fileEngine.raw_connection()
+    target = replicaEngine.raw_connection()
+    try:
+        source.driver_connection.backup(target.driver_connection)
+    finally:
+        target.close()
+        source.close()
+    readDb.remove()
+    return True
+
+refreshReplica()
+
+
+class PlotCache:
+    '''
+    PNG files of the run detail plots, one per (run id, plot name, METRIC_VERSION) in PlotCacheDir. Plots are rendered once, on the
+    first request or by prerender() when the metrics are extracted, instead of on every page view. The plots of a run are cleared when
+    its metrics are extracted again or it's discarded, as SQLite gives its id to the next run.
+    '''
+    plots = {
+        'position': lambda run: run.printNodesPosition(),
+        'latency': lambda run: run.metric.application.latency.printLatency(),
+        'latency-by-node': lambda run: run.metric.application.latency.printLatencyByNode(),
+        'latency-by-position': lambda run: run.metric.application.latency.printLatencyByNodesPosition(),
+        'app-pdr': lambda run: run.metric.application.pdr.printPDR(),
+        'rpl-parent-switches': lambda run: run.metric.rpl.printParentSwitches(),
+        'rpl-network': lambda run: run.metric.rpl.printNetwork(),
+        'rpl-metrics': lambda run: run.metric.rpl.printMetrics(),
+        'mac-retransmissions': lambda run: run.metric.mac.printRetransmissions(),
+        'mac-ingress': lambda run: run.metric.mac.printIngress(),
+        'linkstats-pdr': lambda run: run.metric.linkstats.printPDR(),
+    }
+    # pyplot keeps global state, so only one plot is drawn at a time
+    renderLock = threading.Lock()
+
+    def __init__(self, cacheDir=PlotCacheDir):
+        self.cacheDir = cacheDir
+
+    def path(self, runId, name):
+        return os.path.join(self.cacheDir, "run-{}".format(runId), "{}-v{}.png".format(name, METRIC_VERSION))
+
+    def etag(self, runId, name):
+        '''
+        Changes every time the plot is rendered, None while it isn't
+        '''
+        try:
+            rendered = os.stat(self.path(runId, name)).st_mtime_ns
+        except OSError:
+            return None
+        return "{}-{}-v{}-{:x}".format(runId, name, METRIC_VERSION, rendered)
+
+    def clear(self, runId):
+        import shutil
+        shutil.rmtree(os.path.join(self.cacheDir, "run-{}".format(runId)), ignore_errors=True)
+
+    def available(self, run):
+        if run.metric is None:
+            return ['position']
+        names = list(self.plots)
+        if run.metric.mac is None:
+            names = [n for n in names if not n.startswith('mac-')]
+        return names
+
+    def get(self, run, name):
+        '''
+        Returns the PNG bytes of the plot, rendering and storing it on a miss
+        '''
+        import base64
+        path = self.path(run.id, name)
+        try:
+            with open(path, "rb") as f:
+                return f.read()
+        except OSError:
+            pass
+        with PlotCache.renderLock:
+            import matplotlib.pyplot as plt
+            try:
+                png = base64.b64decode(self.plots[name](run))
+            finally:
+                plt.close('all')
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path + ".partial", "wb") as f:
+            f.write(png)
+        os.replace(path + ".partial", path)
+        return png
+
+    def prerender(self, run):
+        for name in self.available(run):
+            try:
+                self.get(run, name)
+            except Exception as ex:
+                print("Plot {} of run {} failed: {}".format(name, run.id, ex))
+
+    def prerenderAsync(self, runId):
+        '''
+        Renders every plot of the run on a background thread, which loads the run in its own session
+        '''
+        def prerender():
+            try:
+                self.prerender(db.get(Run, runId))
+            finally:
+                db.remove()
+        process = threading.Thread(target=prerender, daemon=True)
+        process.start()
+        return process
@@ -0,0 +1,89 @@
+import sys
+import math
+import random
+import socket
+import threading
+from xml.dom import minidom
+
+
+'''
+Local radio medium for the native build of node-rt (see native-radio-rt.c).
+Every node process sends its frames to the hub, which forwards them to the nodes in range using the UDGM rules of the .csc scenario.
+'''
+class RadioHub(threading.Thread):
+    def __init__(self, simFile, port=60000, seed=None):
+        threading.Thread.__init__(self, daemon=True)
+        self.port = port
+        self.positions = {}
+        doc = minidom.parse(simFile)
+        for mote in doc.getElementsByTagName('mote'):
+            try:
+                myId = int(mote.getElementsByTagName('id')[0].firstChild.data)
+                x = float(mote.getElementsByTagName('x')[0].firstChild.data)
+                y = float(mote.getElementsByTagName('y')[0].firstChild.data)
+                self.positions[myId] = (x, y)
+            except (IndexError, ValueError):
+                continue
+        medium = {}
+        for param in ['transmitting_range', 'success_ratio_tx', 'success_ratio_rx', 'randomseed']:
+            medium[param] = float(doc.getElementsByTagName(param)[0].firstChild.data)
+        self.txRange = medium['transmitting_range']
+        self.successTx = medium['success_ratio_tx']
+        self.successRx = medium['success_ratio_rx']
+        self.random = random.Random(int(medium['randomseed']) if seed is None else seed)
+        self.neighbours = self.getNeighbours()
+        self.frames = 0
+        self.running = False
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind(('127.0.0.1', self.port))
+        self.sock.settimeout(0.5)
+
+    def getNeighbours(self):
+        '''
+        Returns, for each node, the nodes in transmitting range and their reception probability (UDGM distance model)
+        '''
+        neighbours = {}
+        for src, (sx, sy) in self.positions.items():
+            neighbours[src] = []
+            for dst, (dx, dy) in self.positions.items():
+                if src == dst:
+                    continue
+                dist = math.hypot(sx - dx, sy - dy)
+                if dist > self.txRange:
+                    continue
+                distFactor = (dist / self.txRange) ** 2
+                neighbours[src].append((dst, 1.0 - distFactor * (1.0 - self.successRx)))
+        return neighbours
+
+    def run(self):
+        self.running = True
+        while self.running:
+            try:
+                frame, addr = self.sock.recvfrom(256)
+            except socket.timeout:
+                continue
+            except OSError:
+                break
+            if len(frame) < 3:
+                continue
+            src = (frame[0] << 8) | frame[1]
+            self.frames += 1
+            if self.random.random() > self.successTx:
+                continue
+            for dst, ratio in self.neighbours.get(src, []):
+                if self.random.random() <= ratio:
+                    self.sock.sendto(frame, ('127.0.0.1', self.port + dst))
+
+    def stop(self):
+        self.running = False
+        self.join()
+        self.sock.close()
+
+if __name__ == '__main__':
+    hub = RadioHub(sys.argv[1])
+    hub.start()
+    print('Radio hub for {} nodes listening on port {}'.format(len(hub.positions), hub.port))
+    try:
+        hub.join()
+    except KeyboardInterrupt:
+        hub.stop()
@@ -1,5 +1,7 @@
 import sys
 import os
+import re
+import threading
 from subprocess import CalledProcessError, Popen, PIPE, STDOUT
 
 
@@ -7,19 +9,33 @@ from subprocess import CalledProcessError, Popen, PIPE, STDOUT
 Based on run-cooja.py
 '''
 class Runner:
-    def __init__(self, simFile, useJar=False):    
+    def __init__(self, simFile, useJar=False, workDir=None):    
         # get the path of this example
         self.useJar = useJar
         self.SELF_PATH = os.getcwd()
+        # Cooja logs go to workDir, so several runners can work side by side (see Experiment.bulkRun)
+        self.workDir = os.path.abspath(workDir) if workDir else self.SELF_PATH
         # move three levels up
         self.CONTIKI_PATH = os.path.dirname(os.path.dirname(self.SELF_PATH))
         self.COOJA_PATH = os.path.normpath(os.path.join(self.CONTIKI_PATH, "tools", "cooja"))
         if self.useJar:
             self.cooja_jar = os.path.normpath(os.path.join(self.CONTIKI_PATH, "tools", "cooja", "build", "libs", "cooja-full.jar"))
         self.cooja_input = simFile
-        self.logFile = "COOJA.log"
+        self.logFile = os.path.join(self.workDir, "COOJA.log")
         self.log = open(self.logFile,'w')
-        self.cooja_output = "COOJA.testlog"
+        self.cooja_output = os.path.join(self.workDir, "COOJA.testlog")
+        self.proc = None
+        self.cancelled = False
+
+    #######################################################
+    # Stop the simulation from another thread (see JobQueue.cancel)
+
+    def cancel(self):
+        import signal
+        self.cancelled = True
+        if self.proc is not None and self.proc.poll() is None:
+            # Cooja runs under a shell and gradle, so the whole process group goes
+            os.killpg(self.proc.pid, signal.SIGTERM)
 
     #######################################################
     # Run a child process and get its output
@@ -27,8 +43,11 @@ class Runner:
     def run_subprocess(self, args, input_string):
         retcode = -1
         stdoutdata = '\n'
+        if self.cancelled:
+            return (retcode, "cancelled\n")
         try:
-            proc = Popen(args, stdout = self.log, stderr = STDOUT, stdin = PIPE, shell = True)
+            proc = Popen(args, stdout = self.log, stderr = STDOUT, stdin = PIPE, shell = True, cwd = self.workDir, start_new_session = True)
+            self.proc = proc
             #proc = Popen(args, stdout = self.cooja_output, stderr = STDOUT, stdin = PIPE, shell = True)
             (stdoutdata, stderrdata) = proc.communicate(input_string)
             if not stdoutdata:
@@ -46,6 +65,18 @@ class Runner:
         finally:
             return (retcode, stdoutdata)
 
+    #############################################################
+    # Cooja command line, the same for one or several simulation scripts
+
+    def cooja_command(self, filenames):
+        '''
+        The jar is the cooja-full.jar built by "gradlew fulljar", the gradle Cooja of Contiki-NG 4.9 and later, so it takes the same
+        options as gradlew run. The legacy -nogui= syntax belongs to the ant-built cooja.jar, which isn't supported
+        '''
+        if self.useJar:
+            return " ".join(["java -Djava.awt.headless=true -jar", self.cooja_jar, "--no-gui", "--contiki=" + self.CONTIKI_PATH, "--logdir=" + self.workDir] + filenames)
+        return " ".join([self.COOJA_PATH + "/gradlew run --no-watch-fs --parallel --build-cache -p", self.COOJA_PATH, "--args='--gui=false ", " ".join(filenames), "--logdir=" + self.workDir, "'"])
+
     #############################################################
     # Run a single instance of Cooja on a given simulation script
 
@@ -55,11 +86,7 @@ class Runner:
             os.rm(self.cooja_output)
         except:
             pass
-        filename = os.path.join(self.SELF_PATH, cooja_file)
-        if self.useJar:
-            args = " ".join(["java -Djava.awt.headless=true -jar ", self.cooja_jar, "-nogui=" + filename, "-contiki=" + self.CONTIKI_PATH, "--logname=COOJA.log"])
-        else:
-            args = " ".join([self.COOJA_PATH + "/gradlew run --no-watch-fs --parallel --build-cache -p", self.COOJA_PATH, "--args='--gui=false ", filename,"--logdir=" + self.SELF_PATH, "'"])
+        args = self.cooja_command([os.path.join(self.SELF_PATH, cooja_file)])
         sys.stdout.write("  Running Cooja, args={}\n".format(args))
 
         (retcode, output) = self.run_subprocess(args, '')
@@ -86,6 +113,41 @@ class Runner:
         sys.stdout.write(" test done\n")
         return True
 
+    #############################################################
+    # Run several simulation scripts in a single Cooja invocation
+
+    def execute_batch(self, cooja_files):
+        '''
+        Cooja loads and runs the simulations one after the other in the same JVM. Given several, Cooja (Contiki-NG 4.9 and later, see
+        cooja_command) names each test log after its .csc, so every simulation gets a batch-<n>.csc copy next to it (same [CONFIG_DIR]).
+        Its log is then moved to COOJA.testlog in that folder. Returns the status of each simulation.
+        '''
+        import shutil
+        names = []
+        for i, cooja_file in enumerate(cooja_files):
+            name = os.path.join(self.SELF_PATH, os.path.dirname(cooja_file), "batch-{}.csc".format(i))
+            shutil.copy(os.path.join(self.SELF_PATH, cooja_file), name)
+            names.append(name)
+        args = self.cooja_command(names)
+        sys.stdout.write("  Running Cooja with {} simulations, args={}\n".format(len(names), args))
+
+        (retcode, output) = self.run_subprocess(args, '')
+        if retcode != 0:
+            sys.stderr.write("Batch failed, retcode=" + str(retcode) + ", checking each simulation\n")
+
+        results = []
+        for i, name in enumerate(names):
+            testlog = os.path.join(self.workDir, "batch-{}.testlog".format(i))
+            is_done = False
+            if os.access(testlog, os.R_OK):
+                with open(testlog, "r") as f:
+                    is_done = any(line.strip() == "TEST OK" for line in f)
+                shutil.move(testlog, os.path.join(os.path.dirname(name), "COOJA.testlog"))
+            os.remove(name)
+            sys.stdout.write("  {}: {}\n".format(cooja_files[i], "test done" if is_done else "test failed"))
+            results.append(is_done)
+        return results
+
     #######################################################
     # Run the application
 
@@ -104,8 +166,256 @@ class Runner:
         print('Using simulation script "{}"'.format(input_file))
         if not self.execute_test(input_file):
             return (-1)
+        return 0
+
+    def runBatch(self, simFiles):
+        '''
+        Runs the simulations in one Cooja process, saving the JVM startup of all but the first. Returns True/False for each one
+        '''
+        if self.useJar and not os.access(self.cooja_jar, os.R_OK):
+            print('The file "{}" does not exist, trying to build cooja-full.jar !'.format(self.cooja_jar))
+            Popen(self.COOJA_PATH + "/gradlew fulljar", shell=True).wait()
+        missing = [f for f in simFiles if not os.access(f, os.R_OK)]
+        if missing:
+            print('Simulation scripts {} do not exist'.format(missing))
+            return [False] * len(simFiles)
+        return self.execute_batch(simFiles)
 
 #######################################################
 
 #if __name__ == '__main__':
 #    main()
+
+'''
+Runs a .csc scenario with the native build of node-rt: one Linux process per mote, connected by RadioHub.
+Writes COOJA.log and COOJA.testlog in workDir, in the same format as Cooja so the Model parser can be reused. The firmware is built
+in workDir for every run, through the BuildCache like the Cooja builds, and each run gets its own block of hub ports so several
+can run side by side.
+'''
+class NativeRunner:
+    def __init__(self, simFile, firmware="node-rt.native", hubPort=None, workDir=None, cache=None):
+        import re
+        import threading
+        from xml.dom import minidom
+        from BuildCache import BuildCache
+        self.SELF_PATH = os.getcwd()
+        self.workDir = os.path.abspath(workDir) if workDir else self.SELF_PATH
+        self.cooja_input = simFile
+        self.firmware = firmware
+        self.hubPort = hubPort # None picks a free block of ports
+        self.cache = cache if cache is not None else BuildCache()
+        self.logFile = os.path.join(self.workDir, "COOJA.log")
+        self.log = open(self.logFile,'w')
+        self.cooja_output = os.path.join(self.workDir, "COOJA.testlog")
+        self.procs = []
+        self.cancelled = False
+        self.stopped = threading.Event()
+        doc = minidom.parse(simFile)
+        self.nodes = sorted(int(i.firstChild.data) for i in doc.getElementsByTagName('id'))
+        script = doc.getElementsByTagName('script')[0].firstChild.data
+        self.timeout = int(re.search(r"TIMEOUT\((\d+)\)", script).group(1)) # ms
+
+    def cancel(self):
+        '''
+        Stops the motes from another thread (see JobQueue.cancel), run() then returns -1
+        '''
+        self.cancelled = True
+        self.stopped.set()
+        for proc in list(self.procs):
+            if proc.poll() is None:
+                proc.terminate()
+
+    def build(self):
+        '''
+        Builds the firmware of the sources in workDir, or restores the one a previous run built from the same sources
+        '''
+        key = self.cache.key(self.workDir, target="native")
+        if self.cache.restore(key, self.workDir) and os.access(os.path.join(self.workDir, self.firmware), os.X_OK):
+            return True
+        sys.stdout.write("  Building {}\n".format(self.firmware))
+        if Popen("make " + self.firmware + " TARGET=native", shell=True, cwd=self.workDir, stdout=self.log, stderr=STDOUT).wait() != 0:
+            return False
+        self.cache.store(key, self.workDir)
+        return True
+
+    def freePorts(self, attempts=100):
+        '''
+        A base port for the hub such that it and base + each node id are free (RT_HUB_PORT, see native-radio-rt.c)
+        '''
+        import random
+        import socket
+        span = max(self.nodes) + 1
+        for attempt in range(attempts):
+            base = random.randrange(20000, 65535 - span)
+            socks = []
+            try:
+                for port in [base] + [base + nodeId for nodeId in self.nodes]:
+                    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+                    socks.append(sock)
+                    sock.bind(('127.0.0.1', port))
+                return base
+            except OSError:
+                continue
+            finally:
+                for sock in socks:
+                    sock.close()
+        raise OSError("No free block of {} UDP ports for the radio hub".format(span))
+
+    def run(self):
+        import time
+        import shutil
+        import threading
+        from RadioHub import RadioHub
+        if not os.access(self.cooja_input, os.R_OK):
+            print('Simulation script "{}" does not exist'.format(self.cooja_input))
+            return (-1)
+        if not self.build():
+            sys.stderr.write("Failed to build " + self.firmware + "\n")
+            return (-1)
+        hubPort = self.hubPort if self.hubPort is not None else self.freePorts()
+        hub = RadioHub(self.cooja_input, port=hubPort)
+        hub.start()
+        output = open(self.cooja_output, "w")
+        output.write("Starting native logger\n")
+        lock = threading.Lock()
+        start = time.time()
+        # Contiki's stdout is block buffered when piped, stdbuf keeps the log timestamps honest
+        prefix = ["stdbuf", "-oL"] if shutil.which("stdbuf") else []
+        readers = []
+
+        def reader(nodeId, stream):
+            for line in iter(stream.readline, b''):
+                if not line.startswith(b'['):
+                    continue
+                simTime = int((time.time() - start) * 1000000)
+                with lock:
+                    output.write("{} {} {}\n".format(simTime, nodeId, line.decode(errors='replace').rstrip()))
+
+        sys.stdout.write("  Running {} native motes for {} ms (hub port {})\n".format(len(self.nodes), self.timeout, hubPort))
+        for nodeId in self.nodes:
+            if self.cancelled:
+                break
+            env = dict(os.environ, RT_NODE_ID=str(nodeId), RT_HUB_PORT=str(hubPort))
+            proc = Popen(prefix + [os.path.join(self.workDir, self.firmware)], stdout=PIPE, stderr=STDOUT, env=env, cwd=self.workDir)
+            self.procs.append(proc)
+            t = threading.Thread(target=reader, args=(nodeId, proc.stdout), daemon=True)
+            t.start()
+            readers.append(t)
+        end = start + self.timeout / 1000
+        while time.time() < end and not self.cancelled:
+            remaining = end - time.time()
+            done = 100 * (1 - remaining / (self.timeout / 1000))
+            self.log.write("INFO [native] - {:.2f}% completed, {:.1f} sec remaining\n".format(done, remaining))
+            self.log.flush()
+            self.stopped.wait(min(10, max(remaining, 0)))
+        for proc in self.procs:
+            proc.terminate()
+        for proc in self.procs:
+            proc.wait()
+        for t in readers:
+            t.join()
+        hub.stop()
+        if self.cancelled:
+            self.log.write("INFO [native] - Cancelled\n")
+            self.log.close()
+            output.close()
+            return (-1)
+        self.log.write("INFO [native] - Timeout\n")
+        self.log.close()
+        output.write("Test ended at simulation time: {}\n".format(self.timeout * 1000))
+        output.write("TEST OK\n")
+        output.close()
+        sys.stdout.write("  {} frames went through the radio hub\n".format(hub.frames))
+        return 0
+
+'''
+Follows COOJA.log and COOJA.testlog while a simulation runs. Each update only reads the bytes appended since the previous one,
+so polling costs the same at the start and at the end of a long run. Used by the progress endpoints of api.py.
+'''
+class ProgressTracker:
+    progressPattern = re.compile(r'(\d+.\d+|\d+)% completed, (\d+.\d+|\d+) sec remaining')
+
+    def __init__(self, logFile="COOJA.log", testLogFile="COOJA.testlog"):
+        self.logFile = logFile
+        self.testLogFile = testLogFile
+        self.jobId = None
+        self.lock = threading.Lock()
+        self.reset()
+
+    def follow(self, workDir, jobId=None):
+        '''
+        Tracks the Cooja logs of another folder, e.g. the work directory of the job jobId
+        '''
+        with self.lock:
+            self.logFile = os.path.join(workDir, "COOJA.log")
+            self.testLogFile = os.path.join(workDir, "COOJA.testlog")
+            self.jobId = jobId
+            self.reset()
+
+    def reset(self):
+        self.logOffset = 0
+        self.testLogOffset = 0
+        self.partial = b''
+        self.isRun = False
+        self.progress = 0
+        self.toEnd = 999999999
+        self.testLines = 0
+        self.testLogEndsLine = True
+
+    def read(self, fileName, offset):
+        '''
+        Returns the bytes appended to fileName after offset, or None if the file was truncated or replaced by a new run
+        '''
+        try:
+            with open(fileName, "rb") as f:
+                f.seek(0, os.SEEK_END)
+                if f.tell() < offset:
+                    return None
+                f.seek(offset)
+                return f.read()
+        except OSError:
+            return b''
+
+    def parse(self, line):
+        try:
+            data = line.split('-')[1].strip()
+        except IndexError:
+            return
+        if data.startswith('Script timeout in'):
+            self.isRun = True
+        if data.find('completed') != -1:
+            res = self.progressPattern.match(data)
+            if res:
+                self.progress = int(float(res.group(1)))
+                self.toEnd = res.group(2)
+        if data.startswith('Timeout'):
+            self.toEnd = 0
+            self.progress = 100
+        if data.startswith('TEST OK'):
+            self.isRun = False
+
+    def update(self):
+        with self.lock:
+            appended = self.read(self.logFile, self.logOffset)
+            if appended is None:
+                self.reset()
+                appended = self.read(self.logFile, 0)
+            self.logOffset += len(appended)
+            lines = (self.partial + appended).split(b'\n')
+            self.partial = lines.pop()
+            for line in lines:
+                self.parse(line.decode(errors='replace'))
+            appended = self.read(self.testLogFile, self.testLogOffset)
+            if appended is None:
+                self.testLogOffset = 0
+                self.testLines = 0
+                self.testLogEndsLine = True
+                appended = self.read(self.testLogFile, 0)
+            if appended:
+                self.testLogOffset += len(appended)
+                self.testLines += appended.count(b'\n')
+                self.testLogEndsLine = appended.endswith(b'\n')
+            return self.status()
+
+    def status(self):
+        return {'run': self.isRun, 'progress': self.progress, 'doneIn': self.toEnd, 'logFile': self.testLines + (0 if self.testLogEndsLine else 1)}
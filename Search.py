@@ -0,0 +1,160 @@
+import sys
+import math
+import random
+import argparse
+from datetime import datetime
+from Model import db, Experiment, Search, SearchTrial
+
+
+'''
+Successive halving over the RippleTrickle thresholds (sf-simple-rt.h), instead of a bulkRun of every combination.
+A search samples configurations from the space and simulates all of them with a short TIMEOUT (low fidelity), keeps the best
+1/eta by the objective and simulates those eta times longer, until the last ones run with the full TIMEOUT of the scenario.
+Each simulation is a SearchTrial row, and a search started again with the same name skips the trials already simulated.
+
+    python3 Search.py grid-7x7 "benchmark grid-7x7" --configurations 27 --objective "m['app-pdr'] - m['energy-RDC']"
+'''
+# Values of each threshold to try, the defaults of sf-simple-rt.h among them
+ThresholdSpace = {
+    'MinTrickleThreshold': [12, 14, 16, 18],
+    'MidTrickleThreshold': [16, 18, 20, 22],
+    'MaxTrickleThreshold': [18, 20, 22, 24],
+    'QueueThreshold': [2, 4, 6, 8],
+    'MinRankThreshold': [2, 3, 4, 6],
+    'RTRICKLE_DemandRate': [1, 2, 3, 4],
+}
+Defaults = {'MinTrickleThreshold': 16, 'MidTrickleThreshold': 18, 'MaxTrickleThreshold': 20, 'QueueThreshold': 4, 'MinRankThreshold': 4, 'RTRICKLE_DemandRate': 2}
+# Maximized, m is the run summary (Metrics.getSummary keys)
+DefaultObjective = "m['app-pdr'] - 0.01 * m['app-latency']"
+
+def valid(config):
+    '''
+    The Trickle thresholds only make sense in order
+    '''
+    values = dict(Defaults, **config)
+    return values['MinTrickleThreshold'] <= values['MidTrickleThreshold'] <= values['MaxTrickleThreshold']
+
+def sample(space, count, rand):
+    '''
+    Up to count distinct valid configurations drawn uniformly from space
+    '''
+    configs, seen = [], set()
+    for attempt in range(count * 100):
+        if len(configs) == count:
+            break
+        config = {key: rand.choice(values) for key, values in space.items()}
+        key = configKey(config)
+        if key not in seen and valid(config):
+            seen.add(key)
+            configs.append(config)
+    return configs
+
+def configKey(config):
+    return tuple(sorted(config.items()))
+
+def evaluate(objective, summary):
+    '''
+    The objective of a run summary, None when it can't be computed (ex: a metric without value in a short run)
+    '''
+    try:
+        value = float(eval(objective, {'__builtins__': {}, 'abs': abs, 'min': min, 'max': max, 'math': math}, {'m': summary}))
+    except (TypeError, ValueError, KeyError, ZeroDivisionError):
+        return None
+    return None if math.isnan(value) else value
+
+def start(name, experiment, space=None, objective=DefaultObjective, configurations=27, eta=3, repetitions=1, seed=None):
+    '''
+    The search called name, created with these settings the first time, as it was stored afterwards
+    '''
+    search = db.query(Search).filter_by(name=name).first()
+    if search is not None:
+        return search
+    compile(objective, 'objective', 'eval')
+    search = Search(name=name, experiment=experiment, space=dict(space or ThresholdSpace), objective=objective,
+        configurations=configurations, eta=eta, repetitions=repetitions, created=datetime.now())
+    search.candidates = sample(search.space, configurations, random.Random(seed))
+    db.add(search)
+    db.commit()
+    return search
+
+def run(search, concurrency=None, minTimeout=None):
+    '''
+    Runs the rungs of the search, the first with a TIMEOUT of at least minTimeout seconds (default warm up + 2 minutes)
+    '''
+    experiment = search.experiment
+    configs = list(search.candidates)
+    eta = search.eta
+    rungs = int(math.floor(math.log(len(configs)) / math.log(eta) + 1e-9)) if len(configs) > 1 else 0
+    full = experiment.getTimeout()
+    minTimeout = (minTimeout or experiment.getWarmUp() + 120) * 1000
+    seeds = list(range(1, search.repetitions + 1)) # Every configuration sees the same seeds
+    for rung in range(rungs + 1):
+        timeout = int(min(full, max(full * eta ** (rung - rungs), minTimeout)))
+        # Rungs whose TIMEOUT was raised to minTimeout can share simulations
+        done = {(configKey(trial.defines), trial.timeout): trial for trial in search.trials if trial.run_id is not None}
+        todo = [dict(config, randomseed=seed) for config in configs for seed in seeds if (configKey(dict(config, randomseed=seed)), timeout) not in done]
+        print("Search {} rung {} of {}: {} configurations, TIMEOUT {} s, {} runs to simulate".format(search.name, rung + 1, rungs + 1, len(configs), timeout // 1000, len(todo)))
+        if todo:
+            status, runs = experiment.runDefines([dict(defines, TIMEOUT=timeout) for defines in todo], concurrency)
+            for defines, newRun in zip(todo, runs):
+                trial = SearchTrial(search=search, rung=rung, defines=defines, timeout=timeout, run=newRun,
+                    score=evaluate(search.objective, newRun.getSummary()) if newRun is not None else None)
+                db.add(trial)
+                if newRun is not None:
+                    done[(configKey(defines), timeout)] = trial
+            db.commit()
+        scores = []
+        for config in configs:
+            trials = [done.get((configKey(dict(config, randomseed=seed)), timeout)) for seed in seeds]
+            values = [trial.score for trial in trials if trial is not None and trial.score is not None]
+            scores.append((sum(values) / len(values) if len(values) == len(seeds) else -math.inf, config, trials))
+        scores.sort(key=lambda score: -score[0])
+        if rung < rungs:
+            scores = scores[:max(1, len(configs) // eta)]
+            for score, config, trials in scores:
+                for trial in trials:
+                    if trial is not None:
+                        trial.promoted = True
+            configs = [config for score, config, trials in scores]
+        db.commit()
+        for score, config, trials in scores[:3]:
+            print("  {:.3f} {}".format(score, config))
+    search.finished = datetime.now()
+    db.commit()
+    return search.best()
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description="Successive halving search over the RippleTrickle thresholds")
+    parser.add_argument('name', help="search name, an existing search carries on")
+    parser.add_argument('experiment', help="experiment name")
+    parser.add_argument('--space', action='append', default=[], metavar="DEFINE=V1,V2,...", help="replaces the default space")
+    parser.add_argument('--objective', default=DefaultObjective, help="Python expression over the run summary m, maximized")
+    parser.add_argument('--configurations', type=int, default=27)
+    parser.add_argument('--eta', type=int, default=3)
+    parser.add_argument('--repetitions', type=int, default=1)
+    parser.add_argument('--seed', type=int)
+    parser.add_argument('--min-timeout', type=int, help="seconds of the first rung")
+    parser.add_argument('--concurrency', type=int)
+    args = parser.parse_args(argv)
+
+    experiment = db.query(Experiment).filter_by(name=args.experiment).first()
+    if experiment is None:
+        print("No experiment named " + args.experiment)
+        return 1
+    space = None
+    if args.space:
+        space = {}
+        for item in args.space:
+            key, values = item.split("=", 1)
+            space[key] = [int(v) if v.lstrip('-').isdigit() else v for v in values.split(",")]
+    search = start(args.name, experiment, space, args.objective, args.configurations, args.eta, args.repetitions, args.seed)
+    best = run(search, args.concurrency, args.min_timeout)
+    if not best:
+        print("No configuration could be scored")
+        return 1
+    print("Best of {} (objective {}): {:.3f}".format(search.name, search.objective, best[0].score))
+    print(" ".join("{}={}".format(k, v) for k, v in best[0].defines.items() if k != 'randomseed'))
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,185 @@
+import re
+import sys
+import math
+import random
+import argparse
+from copy import deepcopy
+import lxml.etree
+
+
+'''
+Generates Cooja scenarios (.csc) for scaling experiments: grids, lines, random uniform and clustered fields, with one or more sinks.
+The scenario is written from a template .csc (by default 2x2-rippletrickle.csc), so the mote type, build commands and logger script
+are the same as the hand-written ones and only the motes, the UDGM radio medium and the TIMEOUT change.
+Sinks get the ids 1..sinks and the firmware is built with APP_SINK_COUNT=sinks (see node-rt.c), the other nodes follow.
+'''
+class Topology:
+    def __init__(self, positions, sinks=1, name="topology"):
+        self.positions = list(positions)
+        self.name = name
+        if not 1 <= sinks <= len(self.positions):
+            raise ValueError("A topology of {} nodes can't have {} sinks".format(len(self.positions), sinks))
+        # Sinks first, so they get the lowest ids
+        chosen = self.spreadSinks(sinks)
+        self.sinks = sinks
+        self.positions = [self.positions[i] for i in chosen] + [p for i, p in enumerate(self.positions) if i not in chosen]
+
+    @staticmethod
+    def grid(rows, cols, spacing=20.0, **kwargs):
+        '''
+        rows x cols nodes spacing meters apart, numbered column by column like the hand-written scenarios (sink in the corner)
+        '''
+        positions = [(x * spacing, y * spacing) for x in range(cols) for y in range(rows)]
+        return Topology(positions, name="{}x{}".format(rows, cols), **kwargs)
+
+    @staticmethod
+    def line(nodes, spacing=20.0, **kwargs):
+        return Topology([(x * spacing, 0.0) for x in range(nodes)], name="line-{}".format(nodes), **kwargs)
+
+    @staticmethod
+    def randomUniform(nodes, density=20.0, txRange=25.0, seed=None, **kwargs):
+        '''
+        nodes spread uniformly over a square with about one node per density x density meters.
+        Layouts where a node can't reach a sink are drawn again (see connected)
+        '''
+        side = density * math.sqrt(nodes)
+        rand = random.Random(seed)
+        return Topology.draw(lambda: [(rand.uniform(0, side), rand.uniform(0, side)) for n in range(nodes)],
+            txRange, "random-{}".format(nodes), **kwargs)
+
+    @staticmethod
+    def clustered(nodes, clusters=4, radius=30.0, density=20.0, txRange=25.0, seed=None, **kwargs):
+        '''
+        clusters groups of nodes, uniform inside a disc of radius meters around centres placed uniformly over the field
+        '''
+        side = density * math.sqrt(nodes)
+        rand = random.Random(seed)
+        def layout():
+            centres = [(rand.uniform(radius, side - radius), rand.uniform(radius, side - radius)) for c in range(clusters)]
+            positions = []
+            for n in range(nodes):
+                cx, cy = centres[n % clusters]
+                angle = rand.uniform(0, 2 * math.pi)
+                distance = radius * math.sqrt(rand.random())
+                positions.append((cx + distance * math.cos(angle), cy + distance * math.sin(angle)))
+            return positions
+        return Topology.draw(layout, txRange, "clustered-{}x{}".format(clusters, nodes // clusters), **kwargs)
+
+    @staticmethod
+    def draw(layout, txRange, name, attempts=100, **kwargs):
+        for attempt in range(attempts):
+            topology = Topology(layout(), name=name, **kwargs)
+            if topology.connected(txRange):
+                return topology
+        raise ValueError("No connected {} layout in {} attempts, use a smaller density or a larger range".format(name, attempts))
+
+    def spreadSinks(self, sinks):
+        '''
+        Indexes of the sink nodes: the first node, then each time the node farthest from the sinks already chosen
+        '''
+        chosen = [0]
+        distance = [self.distance(p, self.positions[0]) for p in self.positions]
+        while len(chosen) < sinks:
+            far = max(range(len(self.positions)), key=lambda i: distance[i])
+            chosen.append(far)
+            distance = [min(d, self.distance(p, self.positions[far])) for d, p in zip(distance, self.positions)]
+        return chosen
+
+    @staticmethod
+    def distance(a, b):
+        return math.hypot(a[0] - b[0], a[1] - b[1])
+
+    def connected(self, txRange):
+        '''
+        True when every node has a path to some sink through links shorter than txRange
+        '''
+        reached = set(range(self.sinks))
+        frontier = list(reached)
+        while frontier:
+            node = frontier.pop()
+            for other, position in enumerate(self.positions):
+                if other not in reached and self.distance(self.positions[node], position) <= txRange:
+                    reached.add(other)
+                    frontier.append(other)
+        return len(reached) == len(self.positions)
+
+    def toCsc(self, filename, template="2x2-rippletrickle.csc", txRange=25.0, interferenceRange=30.0, successTx=1.0, successRx=1.0, timeout=1200):
+        '''
+        Writes the scenario, timeout is the simulated time in seconds
+        '''
+        doc = lxml.etree.parse(template)
+        simulation = doc.xpath("/simconf/simulation")[0]
+        simulation.xpath("title")[0].text = "Ripple Trickle {}".format(self.name)
+        medium = simulation.xpath("radiomedium")[0]
+        for tag, value in (('transmitting_range', txRange), ('interference_range', interferenceRange), ('success_ratio_tx', successTx), ('success_ratio_rx', successRx)):
+            medium.xpath(tag)[0].text = str(float(value))
+        commands = simulation.xpath("motetype/commands")[0]
+        commands.text = re.sub(r'\s*DEFINES=\S*', '', commands.text)
+        if self.sinks > 1:
+            commands.text += " DEFINES=APP_SINK_COUNT={}".format(self.sinks)
+        motes = simulation.xpath("mote")
+        if not motes:
+            raise ValueError(template + " has no mote to copy")
+        model = motes[0]
+        lastTail = motes[-1].tail
+        for mote in motes:
+            simulation.remove(mote)
+        # The time line of hundreds of motes is only a burden, the scenarios run headless anyway
+        for plugin in doc.xpath("/simconf/plugin[plugin_config/mote]"):
+            plugin.getparent().remove(plugin)
+        for n, (x, y) in enumerate(self.positions):
+            mote = deepcopy(model)
+            mote.xpath(".//x")[0].text = "{:.2f}".format(x)
+            mote.xpath(".//y")[0].text = "{:.2f}".format(y)
+            mote.xpath(".//id")[0].text = str(n + 1)
+            simulation.append(mote)
+        mote.tail = lastTail
+        script = doc.xpath("//plugin_config/script")[0]
+        script.text = re.sub(r'TIMEOUT\(\d+\);[^\n]*', "TIMEOUT({}); /* {} seconds */".format(int(timeout * 1000), timeout), script.text, count=1)
+        doc.write(filename, xml_declaration=True, encoding="UTF-8")
+        return filename
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description="Generates Cooja scenarios for scaling experiments")
+    parser.add_argument('output', help=".csc file to write")
+    parser.add_argument('--template', default="2x2-rippletrickle.csc")
+    parser.add_argument('--sinks', type=int, default=1)
+    parser.add_argument('--tx-range', type=float, default=25.0)
+    parser.add_argument('--interference-range', type=float, default=30.0)
+    parser.add_argument('--success-tx', type=float, default=1.0)
+    parser.add_argument('--success-rx', type=float, default=1.0)
+    parser.add_argument('--timeout', type=int, default=1200, help="simulated seconds")
+    parser.add_argument('--seed', type=int)
+    layouts = parser.add_subparsers(dest='layout', required=True)
+    grid = layouts.add_parser('grid')
+    grid.add_argument('rows', type=int)
+    grid.add_argument('cols', type=int)
+    grid.add_argument('--spacing', type=float, default=20.0)
+    line = layouts.add_parser('line')
+    line.add_argument('nodes', type=int)
+    line.add_argument('--spacing', type=float, default=20.0)
+    uniform = layouts.add_parser('random')
+    uniform.add_argument('nodes', type=int)
+    uniform.add_argument('--density', type=float, default=20.0, help="meters per node side")
+    clustered = layouts.add_parser('clustered')
+    clustered.add_argument('nodes', type=int)
+    clustered.add_argument('--clusters', type=int, default=4)
+    clustered.add_argument('--radius', type=float, default=30.0)
+    clustered.add_argument('--density', type=float, default=20.0, help="meters per node side")
+    args = parser.parse_args(argv)
+
+    if args.layout == 'grid':
+        topology = Topology.grid(args.rows, args.cols, args.spacing, sinks=args.sinks)
+    elif args.layout == 'line':
+        topology = Topology.line(args.nodes, args.spacing, sinks=args.sinks)
+    elif args.layout == 'random':
+        topology = Topology.randomUniform(args.nodes, args.density, args.tx_range, args.seed, sinks=args.sinks)
+    else:
+        topology = Topology.clustered(args.nodes, args.clusters, args.radius, args.density, args.tx_range, args.seed, sinks=args.sinks)
+    if args.layout in ('grid', 'line') and not topology.connected(args.tx_range):
+        print("Warning: some nodes can't reach a sink with a {} m range".format(args.tx_range))
+    topology.toCsc(args.output, args.template, args.tx_range, args.interference_range, args.success_tx, args.success_rx, args.timeout)
+    print("{}: {} nodes, {} sinks".format(args.output, len(topology.positions), topology.sinks))
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
@@ -1,5 +1,6 @@
 # app.py
 from os import name
+import os
 import threading
 from flask import Flask, render_template, send_file, Response, abort, jsonify, request, url_for, redirect, logging
 from sqlalchemy.sql import text
@@ -10,6 +11,9 @@ from flask_httpauth import HTTPBasicAuth
 from werkzeug.security import generate_password_hash, check_password_hash
 # Experiments Models
 from Model import *
+from Runner import ProgressTracker
+from JobQueue import JobQueue
+import time
 
 auth = HTTPBasicAuth()
 
@@ -28,61 +32,157 @@ app.config['MAX_CONTENT_LENGTH'] = 1024 * 1024
 app.config['UPLOAD_EXTENSIONS'] = ['.sql']
 app.config['UPLOAD_PATH'] = 'uploads/'
 
+progressTracker = ProgressTracker()
+plotCache = PlotCache()
+jobQueue = JobQueue(onDone=plotCache.prerender)
+
+@app.teardown_appcontext
+def removeSession(exception=None):
+    db.remove()
+    readDb.remove()
+
+@app.before_request
+def startJobQueue():
+    # Started by the first request, so the debug reloader's parent process doesn't run jobs too
+    jobQueue.start()
+
 @app.route('/')
 def hello():
-    exp = db.query(Experiment).all()
+    exp = readDb.query(Experiment).all()
     qtd = len(exp)
     return render_template("index.html", count=qtd, experiments=exp)
 
 @app.route('/experiment/<id>')
 def detailExperiment(id):
-    exp = db.query(Experiment).filter_by(id=id).first()
+    exp = readDb.query(Experiment).filter_by(id=id).first()
     return render_template("expDetail.html", exp=exp)
 
-def runExperiment(id):
-    db.query(Experiment).filter_by(id=id).first().run()
-
 @app.route('/experiment/run/<id>')
 @auth.login_required
 def showRunStatus(id):
-    process = threading.Thread(target=runExperiment, args=(id,))
-    process.start()
+    exp = db.query(Experiment).filter_by(id=id).first()
+    if exp is None:
+        abort(404)
+    # ?converge=1 stops the run once its metrics settle, with the default ConvergenceMonitor settings
+    convergence = {} if request.args.get('converge', 0, type=int) else None
+    job = jobQueue.submit(exp, priority=request.args.get('priority', 0, type=int), convergence=convergence)
+    progressTracker.follow(job.workDir(), job.id)
     return render_template("run.html", user=auth.current_user())
 
+@app.route('/experiment/<int:id>/bulk', methods=['POST'])
+@auth.login_required
+def bulkExperiment(id):
+    '''
+    Queues a bulkRun sweep, one job per run: {"variations": {"APP_SEND_INTERVAL_SEC": [1, 3, 5]}, "repetitions": 3, "priority": 0}
+    Adding "convergence": {"metrics": ["app-pdr"], "tolerance": 0.05, "window": 120} ends each run early once it settles
+    '''
+    exp = db.query(Experiment).filter_by(id=id).first()
+    if exp is None:
+        abort(404)
+    body = request.get_json(force=True)
+    jobs = jobQueue.submitBulk(exp, body['variations'], int(body.get('repetitions', 1)), int(body.get('priority', 0)), body.get('convergence'))
+    return jsonify([job.toDict() for job in jobs])
+
+@app.route('/jobs')
+def listJobs():
+    query = db.query(Job)
+    if request.args.get('state'):
+        query = query.filter_by(state=request.args['state'])
+    return jsonify([job.toDict() for job in query.order_by(Job.id.desc()).limit(request.args.get('limit', 200, type=int))])
+
+@app.route('/jobs/<int:id>')
+def showJob(id):
+    job = db.get(Job, id)
+    if job is None:
+        abort(404)
+    return jsonify(job.toDict())
+
+@app.route('/jobs/<int:id>/live')
+def showJobLive(id):
+    '''
+    Rolling metrics of a running job (LiveMetrics.RollingMetrics), 404 once it finished
+    '''
+    status = jobQueue.liveStatus(id)
+    if status is None:
+        abort(404)
+    return jsonify(status)
+
+@app.route('/jobs/<int:id>/log')
+def showJobLog(id):
+    job = db.get(Job, id)
+    if job is None or not os.path.exists(job.logFile()):
+        abort(404)
+    return send_file(os.path.abspath(job.logFile()), mimetype='text/plain')
+
+@app.route('/jobs/<int:id>/cancel', methods=['POST'])
+@auth.login_required
+def cancelJob(id):
+    job = jobQueue.cancel(id)
+    if job is None:
+        abort(404)
+    return jsonify(job.toDict())
+
+@app.route('/jobs/<int:id>/requeue', methods=['POST'])
+@auth.login_required
+def requeueJob(id):
+    job = jobQueue.requeue(id, request.args.get('priority', type=int))
+    if job is None:
+        abort(404)
+    return jsonify(job.toDict())
+
 @app.route('/experiment/run/progress')
 @auth.login_required
 def getProgress():
-    isRun = False
-    progress = 0
-    toEnd = 999999999
-    with open("COOJA.log", "r") as f:
-            for line in f.readlines():
-                try:
-                    data = line.split('-')[1].strip()
-                except IndexError:
-                    continue
-                if data.startswith('Script timeout in'):
-                    isRun = True
-                if data.find('completed') != -1:
-                        exp = re.compile('(\d+.\d+|\d+)% completed, (\d+.\d+|\d+) sec remaining').match(data)
-                        progress = int(float(exp.group(1)))
-                        toEnd = exp.group(2)
-                if data.startswith('Timeout'):
-                    toEnd = 0
-                    progress = 100
-                if data.startswith('TEST OK'):
-                    isRun = False
-    log = len(open('COOJA.testlog').readlines())
-    status = {'run': isRun, 'progress': progress, 'doneIn': toEnd, 'logFile': log}
-    return jsonify(status)
+    return jsonify(progressTracker.update())
+
+@app.route('/experiment/run/progress/stream')
+@auth.login_required
+def streamProgress():
+    '''
+    Server-sent events with the run progress, pushed when it changes. The stream ends, with "done" in the last event, once the
+    simulation reaches 100%, Cooja stops running (a run stopped by convergence never times out) or the followed job isn't running
+    anymore (done, failed or cancelled, its "state")
+    '''
+    jobId = progressTracker.jobId
+    def events():
+        last = None
+        idle = 0
+        started = False
+        try:
+            while True:
+                status = progressTracker.update()
+                started = started or status['run']
+                if jobId is not None:
+                    status['state'] = db.query(Job.state).filter_by(id=jobId).scalar()
+                    db.rollback() # The next poll sees the dispatcher's commits
+                status['done'] = status['progress'] == 100 or (started and not status['run']) or status.get('state') not in (None, 'queued', 'running')
+                if status != last:
+                    yield "data: {}\n\n".format(json.dumps(status))
+                    last = status
+                    idle = 0
+                elif idle >= 15:
+                    yield ": keep-alive\n\n"
+                    idle = 0
+                if status['done']:
+                    break
+                time.sleep(1)
+                idle += 1
+        finally:
+            db.remove()
+    return Response(events(), mimetype="text/event-stream", headers={'Cache-Control': 'no-cache', 'X-Accel-Buffering': 'no'})
 
 @app.route('/experiment/run/<id>/metrics')
 @auth.login_required
 def extractMetricFromRun(id):
     run = db.query(Run).filter_by(id=id).first()
+    if run is None:
+        abort(404)
     run.metric = Metrics(run)
+    db.add(run.metric)
     #db.save(run)
     db.commit()
+    plotCache.clear(run.id)
+    plotCache.prerenderAsync(run.id)
     return render_template("runDetail.html", run=run , user=auth.current_user())
 
 @app.route('/experiment/add/', methods=['GET'])
@@ -104,6 +204,56 @@ def executeExperimentAdd():
     qtd = len(experiments)
     return render_template("expAdd.html", count=qtd, experiments=experiments, user=auth.current_user())
 
+@app.route('/experiment/<int:id>/aggregate')
+def aggregateExperiment(id):
+    '''
+    Experiment.aggregate of the runs, ex: /experiment/1/aggregate?groupBy=TSCH_SCHEDULE_CONF_DEFAULT_LENGTH,APP_SEND_INTERVAL_SEC&metrics=app-pdr,app-latency&format=csv
+    format is json (default), csv or parquet
+    '''
+    import io
+    exp = db.query(Experiment).filter_by(id=id).first()
+    if exp is None:
+        abort(404)
+    groupBy = [key for key in request.args.get('groupBy', '').split(',') if key]
+    metrics = [key for key in request.args.get('metrics', '').split(',') if key] or None
+    percentiles = [float(p) for p in request.args.get('percentiles', '50,90,99').split(',') if p]
+    if not groupBy:
+        abort(400, "groupBy is required")
+    try:
+        result = exp.aggregate(groupBy, metrics, [int(p) if p.is_integer() else p for p in percentiles])
+    except KeyError as ex:
+        abort(400, str(ex))
+    format = request.args.get('format', 'json')
+    if format == 'csv':
+        return Response(result.to_csv(index=False), mimetype='text/csv', headers={'Content-Disposition': 'attachment; filename=experiment-{}.csv'.format(id)})
+    if format == 'parquet':
+        buffer = io.BytesIO()
+        result.to_parquet(buffer, index=False)
+        buffer.seek(0)
+        return send_file(buffer, mimetype='application/octet-stream', as_attachment=True, download_name='experiment-{}.parquet'.format(id))
+    return Response(result.to_json(orient='records'), mimetype='application/json')
+
+@app.route('/experiment/<int:id>/latency')
+def latencyExperiment(id):
+    '''
+    Experiment.aggregateLatency, ex: /experiment/1/latency?groupBy=RT_SCHEDULER&dimension=hops&quantiles=90,99,99.9&format=csv
+    '''
+    exp = db.query(Experiment).filter_by(id=id).first()
+    if exp is None:
+        abort(404)
+    groupBy = [key for key in request.args.get('groupBy', '').split(',') if key]
+    dimension = request.args.get('dimension', 'all')
+    if dimension not in ('all', 'node', 'hops', 'window'):
+        abort(400, "dimension is all, node, hops or window")
+    quantiles = [float(q) for q in request.args.get('quantiles', '90,99,99.9').split(',') if q]
+    try:
+        result = exp.aggregateLatency(groupBy, dimension, [int(q) if q.is_integer() else q for q in quantiles])
+    except KeyError as ex:
+        abort(400, str(ex))
+    if request.args.get('format', 'json') == 'csv':
+        return Response(result.to_csv(index=False), mimetype='text/csv', headers={'Content-Disposition': 'attachment; filename=experiment-{}-latency.csv'.format(id)})
+    return Response(result.to_json(orient='records'), mimetype='application/json')
+
 @app.route('/run/<id>')
 def detailRun(id):
     run = db.query(Run).filter_by(id=id).first()
@@ -112,6 +262,27 @@ def detailRun(id):
        hasMetric = True
     return render_template("runDetail.html", run=run, hasMetric=hasMetric)
 
+@app.route('/run/<int:id>/plot/<name>.png')
+def runPlot(id, name):
+    '''
+    A run plot from the PlotCache. The ETag changes whenever the plot is rendered again, so browsers may keep it and revalidate
+    '''
+    if name not in PlotCache.plots:
+        abort(404)
+    run = db.query(Run).filter_by(id=id).first()
+    if run is None or name not in plotCache.available(run):
+        abort(404)
+    response = Response(mimetype='image/png')
+    response.headers['Cache-Control'] = 'public, max-age=86400'
+    etag = plotCache.etag(id, name)
+    if etag is not None and request.if_none_match.contains(etag):
+        response.set_etag(etag)
+        response.status_code = 304
+        return response
+    response.set_data(plotCache.get(run, name))
+    response.set_etag(plotCache.etag(id, name))
+    return response
+
 @app.route('/run/summary/<id>')
 def summaryRun(id):
     run = db.query(Run).filter_by(id=id).first()
@@ -119,22 +290,12 @@ def summaryRun(id):
 
 @app.route('/metrics/slotframe/<size>')
 def metricBySlotFrame(size):
-    retorno = []
-    runs = db.query(Run).all()
-    for r in runs:
-        parameters = r.parameters
-        if parameters['TSCH_SCHEDULE_CONF_DEFAULT_LENGTH'] == size:
-            retorno.append(r)    
+    retorno = Run.withParameters(readDb.query(Run), TSCH_SCHEDULE_CONF_DEFAULT_LENGTH=size).order_by(Run.id).all()
     return render_template("metricSlotFrame.html", id=size, retorno=retorno)
 
 @app.route('/metrics/sendrate/<interval>')
 def metricBySendInterval(interval):
-    retorno = []
-    runs = db.query(Run).all()
-    for r in runs:
-        parameters = r.parameters
-        if parameters['APP_SEND_INTERVAL_SEC'] == interval:
-            retorno.append(r)    
+    retorno = Run.withParameters(readDb.query(Run), APP_SEND_INTERVAL_SEC=interval).order_by(Run.id).all()
     return render_template("metricSentInterval.html", id=interval, retorno=retorno)
 
 @app.route('/admin/db/show', methods=['GET'])
@@ -147,17 +308,16 @@ def showDB():
     qtd = len(exp)
     return render_template("index.html", count=qtd, experiments=exp)   
 
-@app.route('/admin/db/switch', methods=['GET'])
+@app.route('/admin/db/replica', methods=['GET'])
 @auth.login_required
-def switchDB():
-    import sqlite3
-    global engine
-    print ("Engine:", engine)
-    exp = db.query(Experiment).all()
+def refreshDBReplica():
+    '''
+    Takes a new snapshot for the read replica (RT_DB_REPLICA), the listing pages show runs ingested up to now
+    '''
+    if not refreshReplica():
+        abort(404, "No read replica configured, set RT_DB_REPLICA")
+    exp = readDb.query(Experiment).all()
     qtd = len(exp)
-    fisico = sqlite3.connect(DBName)
-    fisico.backup(memConnection)
-    engine = memEngine
     return render_template("index.html", count=qtd, experiments=exp)
 
 if __name__ == '__main__':
@@ -0,0 +1,794 @@
+/*
+ * Copyright (c) 2022, RippleTrickle contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * \file
+ *         Python extension that tokenizes COOJA.testlog in one pass
+ *         (python3 setup.py build_ext --inplace). LogParser.py wraps it and
+ *         holds the equivalent pure Python implementation.
+ *
+ *         tokenize(buffer, records=True, families=True) takes a buffer of
+ *         complete lines and returns (records, families):
+ *           records   (simTime, node, level, type, data) of every mote
+ *                     line, or None. simTime is an int64 array and node an
+ *                     int32 array, as bytes for numpy.frombuffer; the
+ *                     others are lists of str.
+ *           families  {family: {column: bytes}} with the numeric fields of
+ *                     the known message families, or None. "time" and the
+ *                     Energest "value" and "total" columns are int64, the
+ *                     others int32.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#define MAX_COLUMNS       8
+#define STRING_CACHE_SIZE 64
+#define STRING_CACHE_LEN  32
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} buffer_t;
+
+typedef struct {
+  const char *p;
+  const char *end;
+} scan_t;
+
+typedef struct {
+  int64_t time;
+  int32_t node;
+  const char *level;
+  size_t level_len;
+  const char *type;
+  size_t type_len;
+  const char *data;
+  size_t data_len;
+} line_t;
+
+typedef int (*family_parser_t)(scan_t *s, int64_t *values);
+
+typedef struct {
+  const char *name;
+  const char *type;
+  const char *columns[MAX_COLUMNS + 1];
+  const char *sizes; /* 'i' int32 or 'q' int64, one per column */
+  family_parser_t parse;
+} family_t;
+
+typedef struct {
+  char text[STRING_CACHE_LEN];
+  size_t len;
+  PyObject *value;
+} cached_string_t;
+
+static const char *energest_labels[] = {
+  "CPU", "LPM", "Deep LPM", "Radio Rx", "Radio Tx", "Radio total", NULL
+};
+
+/* The DAG states of RPL Lite (rpl_state_to_str) */
+static const char *rpl_states[] = {
+  "initialized", "joined", "reachable", "poisoning", "unknown", NULL
+};
+
+/*---------------------------------------------------------------------------*/
+static int
+buffer_append(buffer_t *b, const void *value, size_t size)
+{
+  if(b->len + size > b->cap) {
+    size_t cap = b->cap ? b->cap * 2 : 4096;
+    char *data;
+
+    while(cap < b->len + size) {
+      cap *= 2;
+    }
+    data = PyMem_Realloc(b->data, cap);
+    if(data == NULL) {
+      PyErr_NoMemory();
+      return -1;
+    }
+    b->data = data;
+    b->cap = cap;
+  }
+  memcpy(b->data + b->len, value, size);
+  b->len += size;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+is_space(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+}
+/*---------------------------------------------------------------------------*/
+static int
+is_digit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+/*---------------------------------------------------------------------------*/
+static int
+is_word(char c)
+{
+  return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+/*---------------------------------------------------------------------------*/
+static int
+hex_value(char c)
+{
+  if(is_digit(c)) {
+    return c - '0';
+  }
+  if(c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if(c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+skip_spaces(scan_t *s)
+{
+  const char *start = s->p;
+
+  while(s->p < s->end && is_space(*s->p)) {
+    s->p++;
+  }
+  return s->p > start;
+}
+/*---------------------------------------------------------------------------*/
+static int
+skip_blanks(scan_t *s)
+{
+  const char *start = s->p;
+
+  while(s->p < s->end && *s->p == ' ') {
+    s->p++;
+  }
+  return s->p > start;
+}
+/*---------------------------------------------------------------------------*/
+static void
+skip_nonspace(scan_t *s)
+{
+  while(s->p < s->end && !is_space(*s->p)) {
+    s->p++;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Consumes the literal if the input continues with it */
+static int
+match(scan_t *s, const char *literal)
+{
+  size_t len = strlen(literal);
+
+  if((size_t)(s->end - s->p) < len || memcmp(s->p, literal, len) != 0) {
+    return 0;
+  }
+  s->p += len;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static const char *
+find(const char *p, const char *end, const char *literal)
+{
+  size_t len = strlen(literal);
+
+  while((size_t)(end - p) >= len) {
+    p = memchr(p, literal[0], end - p - len + 1);
+    if(p == NULL) {
+      return NULL;
+    }
+    if(memcmp(p, literal, len) == 0) {
+      return p;
+    }
+    p++;
+  }
+  return NULL;
+}
+/*---------------------------------------------------------------------------*/
+static int
+read_int(scan_t *s, int64_t *value)
+{
+  const char *start = s->p;
+  int64_t v = 0;
+
+  while(s->p < s->end && is_digit(*s->p)) {
+    v = v * 10 + (*s->p - '0');
+    s->p++;
+  }
+  *value = v;
+  return s->p > start;
+}
+/*---------------------------------------------------------------------------*/
+static int
+read_hex(scan_t *s, int64_t *value)
+{
+  const char *start = s->p;
+  int64_t v = 0;
+
+  while(s->p < s->end && hex_value(*s->p) >= 0) {
+    v = v * 16 + hex_value(*s->p);
+    s->p++;
+  }
+  *value = v;
+  return s->p > start;
+}
+/*---------------------------------------------------------------------------*/
+/* An IPv6 address, (?:[0-9a-fA-F]*:)*([0-9a-fA-F]+): the value of its last group */
+static int
+read_addr(scan_t *s, int64_t *value)
+{
+  const char *end = s->p;
+  const char *group;
+  int64_t v = 0;
+
+  while(end < s->end && (hex_value(*end) >= 0 || *end == ':')) {
+    end++;
+  }
+  while(end > s->p && end[-1] == ':') {
+    end--;
+  }
+  if(end == s->p) {
+    return 0;
+  }
+  for(group = end; group > s->p && group[-1] != ':'; group--);
+  for(; group < end; group++) {
+    v = v * 16 + hex_value(*group);
+  }
+  s->p = end;
+  *value = v;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* Advances to the first occurrence of the literal followed by a number (.*?literal(\d+)) */
+static int
+seek_int(scan_t *s, const char *literal, int64_t *value)
+{
+  const char *p = s->p;
+
+  while((p = find(p, s->end, literal)) != NULL) {
+    scan_t t = { p + strlen(literal), s->end };
+    if(read_int(&t, value)) {
+      s->p = t.p;
+      return 1;
+    }
+    p++;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* send packet to ([0-9a-fA-F]+)\S* with seqno (\d+), queue (\d+)/(\d+) (\d+)/(\d+), len (\d+) (\d+) */
+static int
+parse_tsch_send(scan_t *s, int64_t *v)
+{
+  if(!match(s, "send packet to ") || !read_hex(s, &v[0])) {
+    return 0;
+  }
+  skip_nonspace(s);
+  return match(s, " with seqno ") && read_int(s, &v[1])
+         && match(s, ", queue ") && read_int(s, &v[2]) && match(s, "/") && read_int(s, &v[3])
+         && match(s, " ") && read_int(s, &v[4]) && match(s, "/") && read_int(s, &v[5])
+         && match(s, ", len ") && read_int(s, &v[6]) && match(s, " ") && read_int(s, &v[7]);
+}
+/*---------------------------------------------------------------------------*/
+/* packet sent to ([0-9a-fA-F]+)\S* seqno (\d+), status (\d+), tx (\d+) */
+static int
+parse_tsch_sent(scan_t *s, int64_t *v)
+{
+  if(!match(s, "packet sent to ") || !read_hex(s, &v[0])) {
+    return 0;
+  }
+  skip_nonspace(s);
+  return match(s, " seqno ") && read_int(s, &v[1])
+         && match(s, ", status ") && read_int(s, &v[2])
+         && match(s, ", tx ") && read_int(s, &v[3]);
+}
+/*---------------------------------------------------------------------------*/
+/* received from ([0-9a-fA-F]+)\S* with seqno (\d+) */
+static int
+parse_tsch_received(scan_t *s, int64_t *v)
+{
+  if(!match(s, "received from ") || !read_hex(s, &v[0])) {
+    return 0;
+  }
+  skip_nonspace(s);
+  return match(s, " with seqno ") && read_int(s, &v[1]);
+}
+/*---------------------------------------------------------------------------*/
+/* app generate packet seqnum=(\d+) node_id=\d+ */
+static int
+parse_app_generate(scan_t *s, int64_t *v)
+{
+  int64_t node_id;
+
+  return match(s, "app generate packet seqnum=") && read_int(s, &v[0])
+         && match(s, " node_id=") && read_int(s, &node_id);
+}
+/*---------------------------------------------------------------------------*/
+/* app receive packet seqnum=(\d+) from=<address>$ */
+static int
+parse_app_receive(scan_t *s, int64_t *v)
+{
+  return match(s, "app receive packet seqnum=") && read_int(s, &v[0])
+         && match(s, " from=") && read_addr(s, &v[1]) && s->p == s->end;
+}
+/*---------------------------------------------------------------------------*/
+/* links: +<address> +to +<address> */
+static int
+parse_rpl_links(scan_t *s, int64_t *v)
+{
+  return match(s, "links:") && skip_blanks(s) && read_addr(s, &v[0])
+         && skip_blanks(s) && match(s, "to") && skip_blanks(s) && read_addr(s, &v[1]);
+}
+/*---------------------------------------------------------------------------*/
+/* parent switch: .*? -> (?:\(NULL IP addr\)|<address>), the new parent or -1 */
+static int
+parse_rpl_parent_switch(scan_t *s, int64_t *v)
+{
+  const char *p;
+
+  if(!match(s, "parent switch: ")) {
+    return 0;
+  }
+  for(p = s->p; (p = find(p, s->end, " -> ")) != NULL; p++) {
+    scan_t t = { p + 4, s->end };
+    if(match(&t, "(NULL IP addr)")) {
+      v[0] = -1;
+      return 1;
+    }
+    if(read_addr(&t, &v[0])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* state: (\w*),.*? rank (\d+).*?dioint (\d+).*?nbr count (\d+), anywhere in the line. The state is its index in
+ * rpl_states, -1 for other words */
+static int
+parse_rpl_state(scan_t *s, int64_t *v)
+{
+  const char *p;
+  size_t len;
+  int i;
+
+  for(p = s->p; (p = find(p, s->end, "state: ")) != NULL; p++) {
+    scan_t t = { p + 7, s->end };
+    while(t.p < t.end && is_word(*t.p)) {
+      t.p++;
+    }
+    len = t.p - (p + 7);
+    if(match(&t, ",")) {
+      v[3] = -1;
+      for(i = 0; rpl_states[i] != NULL; i++) {
+        if(strlen(rpl_states[i]) == len && memcmp(rpl_states[i], p + 7, len) == 0) {
+          v[3] = i;
+        }
+      }
+      return seek_int(&t, " rank ", &v[0]) && seek_int(&t, "dioint ", &v[1])
+             && seek_int(&t, "nbr count ", &v[2]);
+    }
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* num packets: tx=(\d+) ack=(\d+) rx=(\d+) queue_drops=(\d+) to=([0-9a-fA-F]+) */
+static int
+parse_linkstats(scan_t *s, int64_t *v)
+{
+  return match(s, "num packets: tx=") && read_int(s, &v[0])
+         && match(s, " ack=") && read_int(s, &v[1])
+         && match(s, " rx=") && read_int(s, &v[2])
+         && match(s, " queue_drops=") && read_int(s, &v[3])
+         && match(s, " to=") && read_hex(s, &v[4]);
+}
+/*---------------------------------------------------------------------------*/
+/* (CPU|LPM|Deep LPM|Radio Rx|Radio Tx|Radio total)\s*:\s*(\d+)/\s*(\d+), the label as its index */
+static int
+parse_energest(scan_t *s, int64_t *v)
+{
+  int i;
+
+  for(i = 0; energest_labels[i] != NULL; i++) {
+    scan_t t = *s;
+
+    if(match(&t, energest_labels[i]) && (skip_spaces(&t), match(&t, ":"))
+       && (skip_spaces(&t), read_int(&t, &v[1])) && match(&t, "/")
+       && (skip_spaces(&t), read_int(&t, &v[2]))) {
+      v[0] = i;
+      return 1;
+    }
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* RippleTrickle - sf-simple: (?:Schedule link (\d+) as (TX|RX) with node ([0-9a-fA-F]+)|Removing link (\d+)),
+ * action 0 for TX, 1 for RX and 2 for a removal (peer -1) */
+static int
+parse_schedule(scan_t *s, int64_t *v)
+{
+  if(!match(s, "RippleTrickle - sf-simple: ")) {
+    return 0;
+  }
+  if(match(s, "Removing link ")) {
+    v[1] = 2;
+    v[2] = -1;
+    return read_int(s, &v[0]);
+  }
+  if(!match(s, "Schedule link ") || !read_int(s, &v[0]) || !match(s, " as ")) {
+    return 0;
+  }
+  if(match(s, "TX")) {
+    v[1] = 0;
+  } else if(match(s, "RX")) {
+    v[1] = 1;
+  } else {
+    return 0;
+  }
+  return match(s, " with node ") && read_hex(s, &v[2]);
+}
+/*---------------------------------------------------------------------------*/
+static const family_t families[] = {
+  { "tsch-send", "TSCH", { "dest", "seqno", "queue", "queueSize", "queueAll", "queueAllSize", "len", "dataLen" }, "iiiiiiii", parse_tsch_send },
+  { "tsch-sent", "TSCH", { "dest", "seqno", "status", "tx" }, "iiii", parse_tsch_sent },
+  { "tsch-received", "TSCH", { "src", "seqno" }, "ii", parse_tsch_received },
+  { "app-generate", "App", { "seqnum" }, "i", parse_app_generate },
+  { "app-receive", "App", { "seqnum", "src" }, "ii", parse_app_receive },
+  { "rpl-links", "RPL", { "child", "parent" }, "ii", parse_rpl_links },
+  { "rpl-parent-switch", "RPL", { "parent" }, "i", parse_rpl_parent_switch },
+  { "rpl-state", "RPL", { "rank", "dioint", "nbrs", "state" }, "iiii", parse_rpl_state },
+  { "linkstats", "Link Stats", { "tx", "ack", "rx", "drops", "to" }, "iiiii", parse_linkstats },
+  { "energest", "Energest", { "kind", "value", "total" }, "iqq", parse_energest },
+  { "schedule", "6top", { "slot", "action", "peer" }, "iii", parse_schedule },
+  { NULL }
+};
+
+#define FAMILIES (sizeof(families) / sizeof(families[0]) - 1)
+
+typedef struct {
+  buffer_t time;
+  buffer_t node;
+  buffer_t columns[MAX_COLUMNS];
+} family_data_t;
+/*---------------------------------------------------------------------------*/
+static void
+strip(const char **text, size_t *len)
+{
+  while(*len > 0 && is_space(**text)) {
+    (*text)++;
+    (*len)--;
+  }
+  while(*len > 0 && is_space((*text)[*len - 1])) {
+    (*len)--;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* ^(\d+)\s+(\d+)\s+\[([^:\]]*):([^\]]*)\]\s*(.*?)\s*$ with level and type stripped */
+static int
+parse_line(const char *p, const char *end, line_t *line)
+{
+  scan_t s = { p, end };
+  int64_t node;
+  const char *start;
+
+  if(!read_int(&s, &line->time) || !skip_spaces(&s) || !read_int(&s, &node)
+     || !skip_spaces(&s) || !match(&s, "[")) {
+    return 0;
+  }
+  line->node = (int32_t)node;
+
+  for(start = s.p; s.p < s.end && *s.p != ':' && *s.p != ']'; s.p++);
+  if(s.p == s.end || *s.p != ':') {
+    return 0;
+  }
+  line->level = start;
+  line->level_len = s.p - start;
+  strip(&line->level, &line->level_len);
+  s.p++;
+
+  for(start = s.p; s.p < s.end && *s.p != ']'; s.p++);
+  if(s.p == s.end) {
+    return 0;
+  }
+  line->type = start;
+  line->type_len = s.p - start;
+  strip(&line->type, &line->type_len);
+  s.p++;
+
+  line->data = s.p;
+  line->data_len = s.end - s.p;
+  strip(&line->data, &line->data_len);
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+add_family_row(family_data_t *data, const line_t *line)
+{
+  const family_t *f;
+  int64_t values[MAX_COLUMNS];
+  int i;
+
+  for(f = families; f->name != NULL; f++, data++) {
+    scan_t s = { line->data, line->data + line->data_len };
+    if(strlen(f->type) != line->type_len || memcmp(f->type, line->type, line->type_len) != 0) {
+      continue;
+    }
+    if(!f->parse(&s, values)) {
+      continue;
+    }
+    if(buffer_append(&data->time, &line->time, sizeof(int64_t)) < 0
+       || buffer_append(&data->node, &line->node, sizeof(int32_t)) < 0) {
+      return -1;
+    }
+    for(i = 0; f->columns[i] != NULL; i++) {
+      int32_t narrow = (int32_t)values[i];
+      int failed = f->sizes[i] == 'q'
+        ? buffer_append(&data->columns[i], &values[i], sizeof(int64_t))
+        : buffer_append(&data->columns[i], &narrow, sizeof(int32_t));
+      if(failed < 0) {
+        return -1;
+      }
+    }
+    return 0;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Level and type strings repeat on every line, so they are decoded once */
+static PyObject *
+cached_string(cached_string_t *cache, int *used, const char *text, size_t len)
+{
+  PyObject *value;
+  int i;
+
+  for(i = 0; i < *used; i++) {
+    if(cache[i].len == len && memcmp(cache[i].text, text, len) == 0) {
+      Py_INCREF(cache[i].value);
+      return cache[i].value;
+    }
+  }
+  value = PyUnicode_DecodeUTF8(text, len, "replace");
+  if(value != NULL && len <= STRING_CACHE_LEN && *used < STRING_CACHE_SIZE) {
+    memcpy(cache[*used].text, text, len);
+    cache[*used].len = len;
+    cache[*used].value = value;
+    Py_INCREF(value);
+    (*used)++;
+  }
+  return value;
+}
+/*---------------------------------------------------------------------------*/
+static int
+append_new(PyObject *list, PyObject *item)
+{
+  int result;
+
+  if(item == NULL) {
+    return -1;
+  }
+  result = PyList_Append(list, item);
+  Py_DECREF(item);
+  return result;
+}
+/*---------------------------------------------------------------------------*/
+static PyObject *
+buffer_to_bytes(buffer_t *b)
+{
+  return PyBytes_FromStringAndSize(b->data != NULL ? b->data : "", b->len);
+}
+/*---------------------------------------------------------------------------*/
+static PyObject *
+build_families(family_data_t *data)
+{
+  PyObject *result = PyDict_New();
+  const family_t *f;
+  int i;
+
+  if(result == NULL) {
+    return NULL;
+  }
+  for(f = families; f->name != NULL; f++, data++) {
+    PyObject *columns = PyDict_New();
+    PyObject *value;
+
+    if(columns == NULL || PyDict_SetItemString(result, f->name, columns) < 0) {
+      Py_XDECREF(columns);
+      Py_DECREF(result);
+      return NULL;
+    }
+    Py_DECREF(columns);
+
+    value = buffer_to_bytes(&data->time);
+    if(value == NULL || PyDict_SetItemString(columns, "time", value) < 0) {
+      goto error;
+    }
+    Py_DECREF(value);
+    value = buffer_to_bytes(&data->node);
+    if(value == NULL || PyDict_SetItemString(columns, "node", value) < 0) {
+      goto error;
+    }
+    Py_DECREF(value);
+    for(i = 0; f->columns[i] != NULL; i++) {
+      value = buffer_to_bytes(&data->columns[i]);
+      if(value == NULL || PyDict_SetItemString(columns, f->columns[i], value) < 0) {
+        goto error;
+      }
+      Py_DECREF(value);
+    }
+    continue;
+error:
+    Py_XDECREF(value);
+    Py_DECREF(result);
+    return NULL;
+  }
+  return result;
+}
+/*---------------------------------------------------------------------------*/
+static PyObject *
+logparser_tokenize(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  static char *keywords[] = { "buffer", "records", "families", NULL };
+  Py_buffer view;
+  int with_records = 1;
+  int with_families = 1;
+  family_data_t data[FAMILIES];
+  buffer_t times = { NULL }, nodes = { NULL };
+  PyObject *levels = NULL, *types = NULL, *texts = NULL;
+  PyObject *records = NULL, *found = NULL, *result = NULL;
+  cached_string_t cache[STRING_CACHE_SIZE];
+  int cached = 0;
+  const char *p, *end, *eol;
+  size_t i;
+  int j;
+
+  (void)self;
+  if(!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|pp", keywords, &view, &with_records, &with_families)) {
+    return NULL;
+  }
+  memset(data, 0, sizeof(data));
+  if(with_records) {
+    levels = PyList_New(0);
+    types = PyList_New(0);
+    texts = PyList_New(0);
+    if(levels == NULL || types == NULL || texts == NULL) {
+      goto done;
+    }
+  }
+
+  p = view.buf;
+  end = p + view.len;
+  for(; p < end; p = eol + 1) {
+    line_t line;
+
+    eol = memchr(p, '\n', end - p);
+    if(eol == NULL) {
+      eol = end;
+    }
+    if(!parse_line(p, eol, &line)) {
+      continue;
+    }
+    if(with_families && add_family_row(data, &line) < 0) {
+      goto done;
+    }
+    if(!with_records) {
+      continue;
+    }
+    if(buffer_append(&times, &line.time, sizeof(int64_t)) < 0
+       || buffer_append(&nodes, &line.node, sizeof(int32_t)) < 0
+       || append_new(levels, cached_string(cache, &cached, line.level, line.level_len)) < 0
+       || append_new(types, cached_string(cache, &cached, line.type, line.type_len)) < 0
+       || append_new(texts, PyUnicode_DecodeUTF8(line.data, line.data_len, "replace")) < 0) {
+      goto done;
+    }
+  }
+
+  if(with_records) {
+    records = Py_BuildValue("(NNOOO)", buffer_to_bytes(&times), buffer_to_bytes(&nodes), levels, types, texts);
+  } else {
+    records = Py_None;
+    Py_INCREF(records);
+  }
+  if(with_families) {
+    found = build_families(data);
+  } else {
+    found = Py_None;
+    Py_INCREF(found);
+  }
+  if(records != NULL && found != NULL) {
+    result = PyTuple_Pack(2, records, found);
+  }
+
+done:
+  Py_XDECREF(records);
+  Py_XDECREF(found);
+  Py_XDECREF(levels);
+  Py_XDECREF(types);
+  Py_XDECREF(texts);
+  for(j = 0; j < cached; j++) {
+    Py_DECREF(cache[j].value);
+  }
+  PyMem_Free(times.data);
+  PyMem_Free(nodes.data);
+  for(i = 0; i < FAMILIES; i++) {
+    PyMem_Free(data[i].time.data);
+    PyMem_Free(data[i].node.data);
+    for(j = 0; j < MAX_COLUMNS; j++) {
+      PyMem_Free(data[i].columns[j].data);
+    }
+  }
+  PyBuffer_Release(&view);
+  return result;
+}
+/*---------------------------------------------------------------------------*/
+static PyMethodDef logparser_methods[] = {
+  { "tokenize", (PyCFunction)(void (*)(void))logparser_tokenize, METH_VARARGS | METH_KEYWORDS,
+    "tokenize(buffer, records=True, families=True) -> (records, families)" },
+  { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef logparser_module = {
+  PyModuleDef_HEAD_INIT, "cooja_logparser",
+  "One pass tokenizer for COOJA.testlog", -1, logparser_methods,
+  NULL, NULL, NULL, NULL
+};
+/*---------------------------------------------------------------------------*/
+PyMODINIT_FUNC
+PyInit_cooja_logparser(void)
+{
+  PyObject *module = PyModule_Create(&logparser_module);
+  PyObject *labels;
+  int i;
+
+  if(module == NULL) {
+    return NULL;
+  }
+  labels = PyTuple_New(sizeof(energest_labels) / sizeof(energest_labels[0]) - 1);
+  if(labels == NULL) {
+    Py_DECREF(module);
+    return NULL;
+  }
+  for(i = 0; energest_labels[i] != NULL; i++) {
+    PyTuple_SET_ITEM(labels, i, PyUnicode_FromString(energest_labels[i]));
+  }
+  if(PyModule_AddObject(module, "ENERGEST_LABELS", labels) < 0) {
+    Py_DECREF(labels);
+    Py_DECREF(module);
+    return NULL;
+  }
+  return module;
+}
+/*---------------------------------------------------------------------------*/
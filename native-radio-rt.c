@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2022, RippleTrickle contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * \file
+ *         Radio driver for the native platform. Frames are exchanged as UDP
+ *         datagrams with a local radio medium hub (RadioHub.py) that applies
+ *         UDGM-like range and loss, so a topology runs as N Linux processes.
+ *
+ *         Datagram layout: [sender id (2 bytes, big endian)][channel][frame]
+ *
+ *         Environment:
+ *           RT_NODE_ID   node id of this process (default 1)
+ *           RT_HUB_PORT  UDP port of the hub; the node listens on
+ *                        RT_HUB_PORT + RT_NODE_ID (default 60000)
+ */
+
+#include "contiki.h"
+#include "sys/node-id.h"
+#include "net/linkaddr.h"
+#include "net/packetbuf.h"
+#include "net/netstack.h"
+#include "dev/radio.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sys/log.h"
+#define LOG_MODULE "Radio"
+#define LOG_LEVEL LOG_LEVEL_NONE
+
+#define RT_RADIO_HEADER_LEN   3
+#define RT_RADIO_MAX_FRAME    127
+#define RT_RADIO_DEFAULT_PORT 60000
+
+static int sock = -1;
+static struct sockaddr_in hub_addr;
+
+static uint8_t tx_buf[RT_RADIO_HEADER_LEN + RT_RADIO_MAX_FRAME];
+
+static uint8_t rx_buf[RT_RADIO_MAX_FRAME];
+static int rx_len;
+static rtimer_clock_t rx_timestamp;
+
+static uint16_t my_id = 1;
+static uint8_t channel = 26;
+static uint8_t radio_is_on;
+static uint8_t poll_mode;
+static uint8_t send_on_cca;
+
+/*---------------------------------------------------------------------------*/
+static void
+set_node_address(uint16_t id)
+{
+  int i;
+
+  /* Same layout as Cooja motes: every 16-bit word carries the node id */
+  for(i = 0; i < LINKADDR_SIZE; i += 2) {
+    linkaddr_node_addr.u8[i] = id >> 8;
+    linkaddr_node_addr.u8[i + 1] = id & 0xff;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+fetch_frame(void)
+{
+  uint8_t buf[RT_RADIO_HEADER_LEN + RT_RADIO_MAX_FRAME];
+  ssize_t len;
+
+  if(rx_len > 0) {
+    return 1;
+  }
+  while((len = recv(sock, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+    /* Frames sent while the radio was off or on another channel are lost */
+    if(!radio_is_on || len <= RT_RADIO_HEADER_LEN || buf[2] != channel) {
+      continue;
+    }
+    rx_len = len - RT_RADIO_HEADER_LEN;
+    memcpy(rx_buf, buf + RT_RADIO_HEADER_LEN, rx_len);
+    rx_timestamp = RTIMER_NOW();
+    return 1;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+radio_init(void)
+{
+  struct sockaddr_in local;
+  const char *env;
+  uint16_t port = RT_RADIO_DEFAULT_PORT;
+
+  env = getenv("RT_NODE_ID");
+  if(env != NULL) {
+    my_id = atoi(env);
+  }
+  env = getenv("RT_HUB_PORT");
+  if(env != NULL) {
+    port = atoi(env);
+  }
+  set_node_address(my_id);
+
+  sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if(sock < 0) {
+    LOG_ERR("could not open socket\n");
+    return 0;
+  }
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  local.sin_port = htons(port + my_id);
+  if(bind(sock, (struct sockaddr *)&local, sizeof(local)) < 0) {
+    LOG_ERR("could not bind port %u\n", port + my_id);
+    close(sock);
+    sock = -1;
+    return 0;
+  }
+  fcntl(sock, F_SETFL, O_NONBLOCK);
+
+  memset(&hub_addr, 0, sizeof(hub_addr));
+  hub_addr.sin_family = AF_INET;
+  hub_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  hub_addr.sin_port = htons(port);
+
+  tx_buf[0] = my_id >> 8;
+  tx_buf[1] = my_id & 0xff;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+radio_prepare(const void *payload, unsigned short payload_len)
+{
+  if(payload_len > RT_RADIO_MAX_FRAME) {
+    return RADIO_TX_ERR;
+  }
+  memcpy(tx_buf + RT_RADIO_HEADER_LEN, payload, payload_len);
+  return RADIO_TX_OK;
+}
+/*---------------------------------------------------------------------------*/
+static int
+radio_transmit(unsigned short transmit_len)
+{
+  if(sock < 0) {
+    return RADIO_TX_ERR;
+  }
+  tx_buf[2] = channel;
+  if(sendto(sock, tx_buf, RT_RADIO_HEADER_LEN + transmit_len, 0,
+            (struct sockaddr *)&hub_addr, sizeof(hub_addr)) < 0) {
+    return RADIO_TX_ERR;
+  }
+  return RADIO_TX_OK;
+}
+/*---------------------------------------------------------------------------*/
+static int
+radio_send(const void *payload, unsigned short payload_len)
+{
+  if(radio_prepare(payload, payload_len) != RADIO_TX_OK) {
+    return RADIO_TX_ERR;
+  }
+  return radio_transmit(payload_len);
+}
+/*---------------------------------------------------------------------------*/
+static int
+radio_read(void *buf, unsigned short buf_len)
+{
+  int len;
+
+  if(!fetch_frame()) {
+    return 0;
+  }
+  len = rx_len < buf_len ? rx_len : buf_len;
+  memcpy(buf, rx_buf, len);
+  rx_len = 0;
+  if(!poll_mode) {
+    packetbuf_set_attr(PACKETBUF_ATTR_RSSI, -50);
+    packetbuf_set_attr(PACKETBUF_ATTR_LINK_QUALITY, 100);
+  }
+  return len;
+}
+/*---------------------------------------------------------------------------*/
+static int
+radio_channel_clear(void)
+{
+  /* The hub serialises all transmissions, there is no carrier to sense */
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+radio_receiving_packet(void)
+{
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+radio_pending_packet(void)
+{
+  return sock >= 0 && fetch_frame();
+}
+/*---------------------------------------------------------------------------*/
+static int
+radio_on(void)
+{
+  radio_is_on = 1;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+radio_off(void)
+{
+  radio_is_on = 0;
+  rx_len = 0;
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+static radio_result_t
+radio_get_value(radio_param_t param, radio_value_t *value)
+{
+  if(value == NULL) {
+    return RADIO_RESULT_INVALID_VALUE;
+  }
+  switch(param) {
+  case RADIO_PARAM_POWER_MODE:
+    *value = radio_is_on ? RADIO_POWER_MODE_ON : RADIO_POWER_MODE_OFF;
+    return RADIO_RESULT_OK;
+  case RADIO_PARAM_CHANNEL:
+    *value = channel;
+    return RADIO_RESULT_OK;
+  case RADIO_PARAM_RX_MODE:
+    *value = poll_mode ? RADIO_RX_MODE_POLL_MODE : 0;
+    return RADIO_RESULT_OK;
+  case RADIO_PARAM_TX_MODE:
+    *value = send_on_cca ? RADIO_TX_MODE_SEND_ON_CCA : 0;
+    return RADIO_RESULT_OK;
+  case RADIO_PARAM_LAST_RSSI:
+  case RADIO_PARAM_RSSI:
+    *value = -50;
+    return RADIO_RESULT_OK;
+  case RADIO_PARAM_LAST_LINK_QUALITY:
+    *value = 100;
+    return RADIO_RESULT_OK;
+  case RADIO_CONST_CHANNEL_MIN:
+    *value = 11;
+    return RADIO_RESULT_OK;
+  case RADIO_CONST_CHANNEL_MAX:
+    *value = 26;
+    return RADIO_RESULT_OK;
+  case RADIO_CONST_MAX_PAYLOAD_LEN:
+    *value = RT_RADIO_MAX_FRAME;
+    return RADIO_RESULT_OK;
+  /* 2.4 GHz O-QPSK figures, the same that Cooja uses for its motes */
+  case RADIO_CONST_PHY_OVERHEAD:
+    *value = 3;
+    return RADIO_RESULT_OK;
+  case RADIO_CONST_BYTE_AIR_TIME:
+    *value = 32;
+    return RADIO_RESULT_OK;
+  case RADIO_CONST_DELAY_BEFORE_TX:
+  case RADIO_CONST_DELAY_BEFORE_RX:
+  case RADIO_CONST_DELAY_BEFORE_DETECT:
+    *value = 0;
+    return RADIO_RESULT_OK;
+  default:
+    return RADIO_RESULT_NOT_SUPPORTED;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static radio_result_t
+radio_set_value(radio_param_t param, radio_value_t value)
+{
+  switch(param) {
+  case RADIO_PARAM_POWER_MODE:
+    if(value == RADIO_POWER_MODE_ON) {
+      radio_on();
+    } else {
+      radio_off();
+    }
+    return RADIO_RESULT_OK;
+  case RADIO_PARAM_CHANNEL:
+    if(value < 11 || value > 26) {
+      return RADIO_RESULT_INVALID_VALUE;
+    }
+    channel = value;
+    return RADIO_RESULT_OK;
+  case RADIO_PARAM_RX_MODE:
+    poll_mode = (value & RADIO_RX_MODE_POLL_MODE) != 0;
+    return RADIO_RESULT_OK;
+  case RADIO_PARAM_TX_MODE:
+    send_on_cca = (value & RADIO_TX_MODE_SEND_ON_CCA) != 0;
+    return RADIO_RESULT_OK;
+  default:
+    return RADIO_RESULT_NOT_SUPPORTED;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static radio_result_t
+radio_get_object(radio_param_t param, void *dest, size_t size)
+{
+  if(param == RADIO_PARAM_LAST_PACKET_TIMESTAMP) {
+    if(size != sizeof(rtimer_clock_t) || dest == NULL) {
+      return RADIO_RESULT_INVALID_VALUE;
+    }
+    *(rtimer_clock_t *)dest = rx_timestamp;
+    return RADIO_RESULT_OK;
+  }
+  return RADIO_RESULT_NOT_SUPPORTED;
+}
+/*---------------------------------------------------------------------------*/
+static radio_result_t
+radio_set_object(radio_param_t param, const void *src, size_t size)
+{
+  return RADIO_RESULT_NOT_SUPPORTED;
+}
+/*---------------------------------------------------------------------------*/
+const struct radio_driver rt_native_radio_driver = {
+  radio_init,
+  radio_prepare,
+  radio_transmit,
+  radio_send,
+  radio_read,
+  radio_channel_clear,
+  radio_receiving_packet,
+  radio_pending_packet,
+  radio_on,
+  radio_off,
+  radio_get_value,
+  radio_set_value,
+  radio_get_object,
+  radio_set_object
+};
+/*---------------------------------------------------------------------------*/
@@ -64,6 +64,11 @@
 #define LOG_LEVEL LOG_LEVEL_INFO
 #define UDP_PORT	8765
 
+/* Nodes 1..APP_SINK_COUNT are RPL roots and TSCH coordinators, see Topology.py for multi-sink scenarios */
+#ifndef APP_SINK_COUNT
+#define APP_SINK_COUNT 1
+#endif
+
 /*---------------------------------------------------------------------------*/
 static void
 udp_rx_callback(struct simple_udp_connection *c,
@@ -95,17 +100,18 @@ AUTOSTART_PROCESSES(&node_process,&my_app);
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(node_process, ev, data)
 {
-#if RPL_WITH_RIPPLETRICKLE
   static int is_coordinator;
+#if RPL_WITH_RIPPLETRICKLE
   static struct etimer et;
   static struct tsch_neighbor *n;
   linkaddr_t *no;
+#endif /* RPL_WITH_RIPPLETRICKLE */
   PROCESS_BEGIN();
 
   is_coordinator = 0;
 
-#if CONTIKI_TARGET_COOJA
-  is_coordinator = (node_id == 1);
+#if CONTIKI_TARGET_COOJA || CONTIKI_TARGET_NATIVE
+  is_coordinator = (node_id <= APP_SINK_COUNT);
 #endif
 
   if(is_coordinator) {
@@ -113,6 +119,8 @@ PROCESS_THREAD(node_process, ev, data)
   }
 
   NETSTACK_MAC.on();
+
+#if RPL_WITH_RIPPLETRICKLE
   sixtop_add_sf(&sf_rt_driver);
 
   etimer_set(&et, CLOCK_SECOND * 5);
@@ -173,8 +181,8 @@ PROCESS_THREAD(my_app, ev, data)
   simple_udp_register(&udp_conn, UDP_PORT, NULL,
                       UDP_PORT, udp_rx_callback);
 
-#if CONTIKI_TARGET_COOJA
-  is_coordinator = (node_id == 1);
+#if CONTIKI_TARGET_COOJA || CONTIKI_TARGET_NATIVE
+  is_coordinator = (node_id <= APP_SINK_COUNT);
 #endif
 
   if(is_coordinator) {
@@ -90,11 +90,23 @@
 #define TSCH_CONF_MAC_MAX_FRAME_RETRIES 3
 #define TSCH_QUEUE_CONF_NUM_PER_NEIGHBOR 32
 #define ENERGEST_CONF_ON 1
+/* The Makefile sets it to 0 for the other RT_SCHEDULER builds */
+#ifndef RPL_CONF_WITH_RIPPLETRICKLE
 #define RPL_CONF_WITH_RIPPLETRICKLE 1
+#endif
 
 #define TSCH_CONF_DEFAULT_HOPPING_SEQUENCE TSCH_HOPPING_SEQUENCE_4_16
 
+#if RPL_CONF_WITH_RIPPLETRICKLE
 #define RPL_CALLBACK_PARENT_SWITCH rt_tsch_rpl_callback_parent_switch
+#endif
+
+#if CONTIKI_TARGET_NATIVE
+/* Frames are exchanged through the local radio medium hub (RadioHub.py) */
+#define NETSTACK_CONF_RADIO rt_native_radio_driver
+/* Linux processes run at wall-clock speed, give TSCH longer timeslots */
+#define TSCH_CONF_DEFAULT_TIMESLOT_TIMING tsch_timeslot_timing_us_15000
+#endif /* CONTIKI_TARGET_NATIVE */
 
 #if WITH_SECURITY
 
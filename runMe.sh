@@ -2,6 +2,8 @@
 #
 # 1 - Install requisites via pip
 sudo pip install -r requirements.txt
+# 1.1 - Build the compiled log parser (optional, LogParser.py falls back to pure Python)
+python3 setup.py build_ext --inplace
 #
 # 2 - We use the viewconf tool to get Environment so we need to put these lines on the end
 echo \#\#\#\#\# \"APP_SEND_INTERVAL_SEC\": _________________ == APP_SEND_INTERVAL_SEC >> ../../tools/viewconf/viewconf.c
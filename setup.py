@@ -0,0 +1,7 @@
+from setuptools import setup, Extension
+
+# Builds the COOJA.testlog tokenizer used by LogParser.py: python3 setup.py build_ext --inplace
+setup(
+    name='cooja_logparser',
+    ext_modules=[Extension('cooja_logparser', sources=['cooja_logparser.c'], extra_compile_args=['-O3'])],
+)
@@ -68,12 +68,27 @@ void rt_tsch_rpl_callback_parent_switch (rpl_parent_t *old, rpl_parent_t *new);
 // SF Constants
 #define SF_SIMPLE_MAX_LINKS  3
 #define RTRICKLE_MAX_LINKS 5
-#define RTRICKLE_DemandRate 2 //
+
+/* RippleTrickle thresholds, project-conf.h can override them (see Search.py) */
+#ifndef RTRICKLE_DemandRate
+#define RTRICKLE_DemandRate 2
+#endif
+#ifndef MinTrickleThreshold
 #define MinTrickleThreshold 16
+#endif
+#ifndef MidTrickleThreshold
 #define MidTrickleThreshold 18
+#endif
+#ifndef MaxTrickleThreshold
 #define MaxTrickleThreshold 20
+#endif
+#ifndef MinRankThreshold
 #define MinRankThreshold 4
+#endif
+#ifndef QueueThreshold
 #define QueueThreshold 4
+#endif
+
 #define SF_SIMPLE_SFID       0xf0
 extern const sixtop_sf_t sf_rt_driver;
 
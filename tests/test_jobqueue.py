@@ -0,0 +1,99 @@
+import os
+import sys
+import shutil
+import tempfile
+import unittest
+from unittest import mock
+from concurrent.futures import ThreadPoolExecutor, wait
+
+
+'''
+JobQueue without Cooja: the runner copies tests/data/short.testlog as the simulation log. Model opens Metrics.db in the working
+directory when it's imported, so the test moves to a scratch directory with the scenario and firmware sources first.
+
+    python3 -m unittest discover tests
+'''
+Repo = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+TestLog = os.path.join(Repo, "tests", "data", "short.testlog")
+Sources = ("2x2-rippletrickle.csc", "Makefile", "node-rt.c", "sf-simple-rt.c", "sf-simple-rt.h", "native-radio-rt.c", "project-conf.h")
+Parameters = {'MAKE_MAC': 'MAKE_MAC_TSCH', 'MAKE_ROUTING': 'MAKE_ROUTING_RPL_LITE', 'MAKE_NET': 'MAKE_NET_IPV6', 'APP_WARM_UP_PERIOD_SEC': '300'}
+
+class FakeRunner:
+    def __init__(self, simFile, workDir="."):
+        self.workDir = workDir
+        self.log = open(os.path.join(workDir, "COOJA.log"), "w")
+
+    def run(self):
+        shutil.copy(TestLog, os.path.join(self.workDir, "COOJA.testlog"))
+        return 0
+
+    def cancel(self):
+        pass
+
+class LiveIngestAbortedTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.cwd = os.getcwd()
+        cls.dir = tempfile.mkdtemp()
+        for name in Sources:
+            shutil.copy(os.path.join(Repo, name), cls.dir)
+        os.chdir(cls.dir)
+        sys.path.insert(0, Repo)
+        global Model, JobQueue
+        import Model
+        import JobQueue
+
+    @classmethod
+    def tearDownClass(cls):
+        os.chdir(cls.cwd)
+        shutil.rmtree(cls.dir, ignore_errors=True)
+
+    def test_job_completes_after_live_ingest_aborts(self):
+        db = Model.db
+        experiment = Model.Experiment(name="live abort", experimentFile="2x2-rippletrickle.csc")
+        db.add(experiment)
+        db.commit()
+        with mock.patch.object(JobQueue, 'Runner', FakeRunner), \
+                mock.patch.object(Model.Run, 'getBulkParameters', lambda self, *args: dict(Parameters)), \
+                mock.patch.object(JobQueue.LiveIngest, 'poll', side_effect=IOError("disk full")):
+            queue = JobQueue.JobQueue(slots=1)
+            job = queue.submit(experiment)
+            with ThreadPoolExecutor(max_workers=1) as pool:
+                queue.dispatch(pool)
+                wait(list(queue.running))
+                queue.pollLive()
+                self.assertNotIn(job.id, queue.live)
+                queue.finish(next(iter(queue.running)))
+        db.refresh(job)
+        self.assertEqual(job.state, 'done', job.message)
+        self.assertIsNotNone(job.run)
+        self.assertIsNone(job.run.stopTime)
+        runs = db.query(Model.Run).all()
+        self.assertEqual([run.id for run in runs], [job.run.id])
+        self.assertIs(runs[0].experiment, experiment)
+        self.assertGreater(db.query(Model.Record).filter_by(run_id=job.run.id).count(), 0)
+
+    def test_resume_discards_the_live_run(self):
+        db = Model.db
+        experiment = Model.Experiment(name="resume", experimentFile="2x2-rippletrickle.csc")
+        db.add(experiment)
+        db.commit()
+        with mock.patch.object(JobQueue, 'Runner', FakeRunner):
+            queue = JobQueue.JobQueue(slots=1)
+            job = queue.submit(experiment)
+            with ThreadPoolExecutor(max_workers=1) as pool:
+                queue.dispatch(pool)
+                wait(list(queue.running))
+                queue.pollLive()
+        liveRun = job.liveRun_id
+        self.assertGreater(db.query(Model.Record).filter_by(run_id=liveRun).count(), 0)
+        # The process died here, the next queue finds the job running
+        JobQueue.JobQueue(slots=1).resume()
+        db.refresh(job)
+        self.assertEqual(job.state, 'queued')
+        self.assertIsNone(job.liveRun_id)
+        self.assertIsNone(db.get(Model.Run, liveRun))
+        self.assertEqual(db.query(Model.Record).filter_by(run_id=liveRun).count(), 0)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,116 @@
+import os
+import sys
+import unittest
+import numpy as np
+
+
+'''
+LatencyHistogram on synthetic latencies: the bucket layout, the quantile error bound against numpy, merging and byKey.
+
+    python3 -m unittest discover tests
+'''
+Repo = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, Repo)
+from LatencyHistogram import LatencyHistogram, SignificantBits
+
+def lognormal(count, seed=1):
+    '''
+    Latencies in us around 200 ms with a long tail, like a multi-hop TSCH network
+    '''
+    return np.random.default_rng(seed).lognormal(np.log(200000), 0.8, count).astype(np.int64)
+
+class BucketTest(unittest.TestCase):
+    def test_small_values_are_exact(self):
+        histogram = LatencyHistogram()
+        values = np.arange(1 << SignificantBits)
+        np.testing.assert_array_equal(LatencyHistogram.buckets(values), values)
+        for value in values.tolist():
+            self.assertEqual(histogram.lowest(value), value)
+            self.assertEqual(histogram.highest(value), value)
+
+    def test_buckets_are_contiguous(self):
+        histogram = LatencyHistogram()
+        for index in range(1, 30 << (SignificantBits - 1)):
+            self.assertEqual(histogram.highest(index - 1) + 1, histogram.lowest(index), index)
+
+    def test_values_fall_in_their_bucket(self):
+        histogram = LatencyHistogram()
+        # Around every power of two up to an hour, where the bucket width doubles
+        values = np.array([(1 << k) + d for k in range(1, 32) for d in (-2, -1, 0, 1, 2)] + lognormal(10000).tolist())
+        values = values[values >= 0]
+        for value, index in zip(values.tolist(), LatencyHistogram.buckets(values).tolist()):
+            self.assertLessEqual(histogram.lowest(index), value)
+            self.assertGreaterEqual(histogram.highest(index), value)
+            self.assertLessEqual(histogram.highest(index) - histogram.lowest(index), value * 2 ** (1 - SignificantBits))
+
+class QuantileTest(unittest.TestCase):
+    def test_quantiles_are_within_the_bucket_error(self):
+        values = lognormal(100000)
+        histogram = LatencyHistogram.of(values)
+        for q in (1, 50, 90, 99, 99.9, 100):
+            exact = np.percentile(values, q, method='inverted_cdf')
+            found = histogram.quantile(q)
+            # The highest value of the bucket holding the rank: never below, at most one bucket width above
+            self.assertGreaterEqual(found, exact, q)
+            self.assertLessEqual((found - exact) / exact, 2 ** (1 - SignificantBits), q)
+
+    def test_tail_quantile(self):
+        values = lognormal(100000)
+        exact = np.percentile(values, 99.9, method='inverted_cdf')
+        self.assertLess((LatencyHistogram.of(values).quantile(99.9) - exact) / exact, 0.004)
+
+    def test_minimum_maximum_and_mean_are_exact(self):
+        values = lognormal(100000)
+        histogram = LatencyHistogram.of(values)
+        self.assertEqual(histogram.minimum, values.min())
+        self.assertEqual(histogram.quantile(100), values.max())
+        self.assertEqual(histogram.total, len(values))
+        self.assertAlmostEqual(histogram.mean(), values.mean())
+
+    def test_empty(self):
+        histogram = LatencyHistogram.of([])
+        self.assertEqual(histogram.total, 0)
+        self.assertIsNone(histogram.quantile(50))
+        self.assertIsNone(histogram.mean())
+        self.assertEqual(LatencyHistogram.byKey([], []), {})
+
+class MergeTest(unittest.TestCase):
+    def assertSameHistogram(self, expected, found):
+        self.assertEqual(expected.counts, found.counts)
+        self.assertEqual((expected.total, expected.sum, expected.minimum, expected.maximum), (found.total, found.sum, found.minimum, found.maximum))
+        qs = (50, 90, 99, 99.9)
+        self.assertEqual(expected.quantiles(qs), found.quantiles(qs))
+
+    def test_merged_halves_equal_a_single_pass(self):
+        values = lognormal(100000)
+        whole = LatencyHistogram.of(values)
+        self.assertSameHistogram(whole, LatencyHistogram.of(values[:40000]).merge(LatencyHistogram.of(values[40000:])))
+        self.assertSameHistogram(whole, LatencyHistogram.mergeAll(LatencyHistogram.of(part) for part in np.array_split(values, 7)))
+        self.assertSameHistogram(whole, LatencyHistogram.of([]).merge(whole))
+
+    def test_record_equals_of(self):
+        values = lognormal(2000)
+        histogram = LatencyHistogram()
+        for value in values.tolist():
+            histogram.record(value)
+        self.assertSameHistogram(LatencyHistogram.of(values), histogram)
+
+    def test_bits_must_match(self):
+        with self.assertRaises(ValueError):
+            LatencyHistogram(8).merge(LatencyHistogram(10))
+
+class ByKeyTest(unittest.TestCase):
+    def test_one_histogram_per_key(self):
+        values = lognormal(20000)
+        keys = np.random.default_rng(2).integers(2, 12, len(values))
+        histograms = LatencyHistogram.byKey(keys, values)
+        self.assertEqual(sorted(histograms), sorted(set(keys.tolist())))
+        for key, histogram in histograms.items():
+            expected = LatencyHistogram.of(values[keys == key])
+            self.assertEqual(histogram.counts, expected.counts, key)
+            self.assertEqual((histogram.total, histogram.sum, histogram.minimum, histogram.maximum),
+                (expected.total, expected.sum, expected.minimum, expected.maximum), key)
+        self.assertEqual(LatencyHistogram.mergeAll(histograms.values()).counts, LatencyHistogram.of(values).counts)
+
+if __name__ == '__main__':
+    unittest.main()
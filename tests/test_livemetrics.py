@@ -0,0 +1,95 @@
+import os
+import sys
+import unittest
+import numpy as np
+
+
+'''
+RollingMetrics and ConvergenceMonitor on synthetic input: tokenized families built by hand and RollingMetrics statuses.
+
+    python3 -m unittest discover tests
+'''
+Repo = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, Repo)
+import LogParser
+from LiveMetrics import RollingMetrics, ConvergenceMonitor
+
+def families(**rows):
+    '''
+    Tokenized families as LogParser.toArrays returns them, rows being {family: [(time, node, column values...)]}
+    '''
+    result = {}
+    for family, (recordType, columns, pattern, search, convert) in LogParser.families.items():
+        values = list(zip(*rows.get(family, []))) or [[] for column in ['time', 'node'] + columns]
+        result[family] = {column: np.array(v, dtype=LogParser.columnType(column)) for column, v in zip(['time', 'node'] + columns, values)}
+    return result
+
+def traffic(start, end, received, period=1000000, latency=200000):
+    '''
+    Node 2 generates a packet every period from start to end (us), the sink receives them latency later when received is True
+    '''
+    generate = [(time, 2, time // period) for time in range(start, end, period)]
+    receive = [(time + latency, 1, seqnum, 2) for time, node, seqnum in generate] if received else []
+    return families(**{'app-generate': generate, 'app-receive': receive})
+
+class RollingMetricsTest(unittest.TestCase):
+    def test_pdr_is_over_the_window(self):
+        metrics = RollingMetrics(window=60000000, settle=10000000)
+        metrics.update(traffic(0, 60000000, received=False))
+        metrics.update(traffic(60000000, 200000000, received=True))
+        status = metrics.status()
+        # The last reception is at 199.2 s: packets generated in [129.2 s, 189.2 s], all received, the early losses are out of the window
+        self.assertEqual(status['app-pdr'], 100)
+        self.assertEqual(status['app-genPkg'], 200)
+        self.assertEqual(status['app-rcvPkg'], 140)
+
+    def test_pdr_follows_a_drop(self):
+        metrics = RollingMetrics(window=60000000, settle=10000000)
+        metrics.update(traffic(0, 100000000, received=True))
+        metrics.update(traffic(100000000, 130000000, received=False))
+        # The last packet is at 129 s, so the window is [59 s, 119 s]: 41 received, 20 lost. Cumulative it would be 100 of 120
+        self.assertAlmostEqual(metrics.status()['app-pdr'], 100 * 41 / 61)
+
+    def test_old_packets_are_pruned(self):
+        metrics = RollingMetrics(window=60000000, settle=10000000)
+        for start in range(0, 600000000, 10000000):
+            metrics.update(traffic(start, start + 10000000, received=True))
+        self.assertLessEqual(len(metrics.generated), 71)
+        self.assertLessEqual(len(metrics.received), 71)
+        self.assertEqual(metrics.status()['app-genPkg'], 600)
+
+def statuses(pdr, start=0, end=1200, step=10):
+    '''
+    RollingMetrics statuses every step seconds with pdr(seconds) and a steady latency and schedule
+    '''
+    for seconds in range(start, end + 1, step):
+        yield {'simTime': seconds * 1000000, 'app-pdr': pdr(seconds), 'app-latency': 250.0, '6top-cells': 12}
+
+class ConvergenceMonitorTest(unittest.TestCase):
+    def test_flat_series_converges(self):
+        monitor = ConvergenceMonitor(tolerance=0.05, window=120, warmUp=300)
+        converged = [status['simTime'] for status in statuses(lambda s: 90 + (s % 20) / 10) if monitor.update(status)]
+        self.assertTrue(converged)
+        self.assertEqual(monitor.stopTime, 420 * 1000000)
+        self.assertEqual(converged[0], monitor.stopTime)
+
+    def test_drifting_series_does_not_converge(self):
+        monitor = ConvergenceMonitor(tolerance=0.05, window=120, warmUp=300)
+        # Loses 0.05 points a second: 6 points over every window, more than 5% of the PDR
+        for status in statuses(lambda s: 100 - 0.05 * s):
+            self.assertFalse(monitor.update(status), status['simTime'])
+        self.assertIsNone(monitor.reason)
+
+    def test_degrading_link_does_not_converge(self):
+        # From 300 s one more packet in ten is lost every minute. Since the start, the PDR would still be 90% at 600 s
+        metrics = RollingMetrics(window=60000000, settle=10000000)
+        monitor = ConvergenceMonitor(metrics=('app-pdr',), tolerance=0.05, window=120, warmUp=300)
+        for start in range(0, 900000000, 10000000):
+            lost = max(start - 300000000, 0) // 60000000
+            generate = [(time, 2, time // 1000000) for time in range(start, start + 10000000, 1000000)]
+            receive = [(time + 200000, 1, seqnum, 2) for time, node, seqnum in generate if seqnum % 10 >= lost]
+            metrics.update(families(**{'app-generate': generate, 'app-receive': receive}))
+            self.assertFalse(monitor.update(metrics.status()), start)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,61 @@
+import os
+import sys
+import unittest
+import numpy as np
+
+
+'''
+The cooja_logparser extension against the pure Python tokenizer of LogParser, on tests/data/short.testlog. The extension test is
+skipped when it isn't built (python3 setup.py build_ext --inplace).
+
+    python3 -m unittest discover tests
+'''
+Repo = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+TestLog = os.path.join(Repo, "tests", "data", "short.testlog")
+sys.path.insert(0, Repo)
+import LogParser
+
+class TokenizerTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        with open(TestLog, 'rb') as f:
+            cls.buffer = f.read()
+        cls.python = LogParser.toArrays(*LogParser.tokenizePython(cls.buffer))
+
+    def assertSameFamilies(self, expected, found):
+        self.assertEqual(sorted(expected), sorted(found))
+        for family, columns in expected.items():
+            self.assertEqual(sorted(columns), sorted(found[family]), family)
+            for column, values in columns.items():
+                self.assertEqual(values.dtype, found[family][column].dtype, (family, column))
+                np.testing.assert_array_equal(values, found[family][column], err_msg="{} {}".format(family, column))
+
+    def test_every_family_is_found(self):
+        for family, columns in self.python[1].items():
+            self.assertGreater(len(columns['time']), 0, family)
+
+    @unittest.skipIf(LogParser.cooja_logparser is None, "cooja_logparser isn't built")
+    def test_extension_matches_python(self):
+        lines, families = LogParser.toArrays(*LogParser.cooja_logparser.tokenize(self.buffer))
+        expected = self.python[0]
+        np.testing.assert_array_equal(lines[0], expected[0])
+        np.testing.assert_array_equal(lines[1], expected[1])
+        self.assertEqual(lines[2:], expected[2:])
+        self.assertSameFamilies(self.python[1], families)
+
+    @unittest.skipIf(LogParser.cooja_logparser is None, "cooja_logparser isn't built")
+    def test_extension_without_records_or_families(self):
+        lines, families = LogParser.cooja_logparser.tokenize(self.buffer, records=False)
+        self.assertIsNone(lines)
+        self.assertSameFamilies(self.python[1], LogParser.toArrays(None, families)[1])
+        lines, families = LogParser.cooja_logparser.tokenize(self.buffer, families=False)
+        self.assertIsNone(families)
+
+    def test_records_tokenize_like_the_log(self):
+        # Metrics.getColumns tokenizes the stored records, written back as log lines
+        simTime, node, level, recordType, data = self.python[0]
+        records = zip(simTime.tolist(), node.tolist(), level, recordType, data)
+        self.assertSameFamilies(self.python[1], LogParser.tokenizeLines(records))
+
+if __name__ == '__main__':
+    unittest.main()